@@ -1,8 +1,21 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cinttypes>
+#include <condition_variable>
+#include <exception>
 #include <functional>
 #include <istream>
+#include <limits>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 namespace cppcson {
@@ -75,8 +88,92 @@ public:
   NestingTooDeepError();
 };
 
+class CancelledError : public Error {
+public:
+  explicit CancelledError(const Location &location);
+};
+
+class LimitExceededError : public Error {
+public:
+  explicit LimitExceededError(const std::string &message,
+                              const Location &location);
+};
+
+class CompressionError : public Error {
+public:
+  explicit CompressionError(const std::string &message);
+};
+
+class EmitterError : public Error {
+public:
+  explicit EmitterError(const std::string &message);
+};
+
+class BinaryFormatError : public Error {
+public:
+  explicit BinaryFormatError(const std::string &message);
+};
+
+class PatchError : public Error {
+public:
+  explicit PatchError(const std::string &message);
+};
+
+class SchemaError : public Error {
+public:
+  explicit SchemaError(const std::string &message, const Location &location);
+};
+
+class PathError : public Error {
+public:
+  explicit PathError(const std::string &message);
+};
+
+// String view of a key literal, e.g. "port"_key, whose length is computed by
+// the compiler. Snapshot views compare it in place. Values copy it into a
+// reused buffer, which avoids allocations but searches like a std::string key,
+// as ordered maps only search by std::string in C++11.
+class Key {
+private:
+  const char *keyData;
+  size_t keyLength;
+
+public:
+  constexpr Key(const char *data, size_t length)
+      : keyData(data), keyLength(length) {}
+
+  template <size_t N>
+  constexpr explicit Key(const char (&literal)[N]) : Key(literal, N - 1) {}
+
+  constexpr const char *data() const { return keyData; }
+
+  constexpr size_t length() const { return keyLength; }
+
+  std::string toString() const;
+
+  bool operator==(const Key &other) const;
+
+  bool operator!=(const Key &other) const;
+};
+
+namespace literals {
+constexpr Key operator"" _key(const char *data, size_t length) {
+  return Key(data, length);
+}
+} // namespace literals
+
 class Value;
 
+class Path;
+
+namespace internal {
+template <typename Output> class Serializer;
+
+struct SerializationCache;
+
+template <typename Items> struct Shared;
+} // namespace internal
+
 class Keys {
   friend Value;
 
@@ -115,6 +212,14 @@ public:
 
 class Value {
   friend class Parser;
+  friend class BinaryReader;
+  friend class BinaryWriter;
+  friend class ValueView;
+  friend class Patcher;
+  friend class Binder;
+  friend class Schema;
+  friend class Path;
+  template <typename Output> friend class internal::Serializer;
 
 public:
   enum class Kind { Bool, Int, Float, String, Null, Array, Object };
@@ -124,8 +229,8 @@ private:
     bool boolValue;
     int64_t intValue;
     double floatValue;
-    const std::vector<Value> *arrayValue;
-    const std::map<std::string, Value> *objectValue;
+    internal::Shared<std::vector<Value>> *arrayValue;
+    internal::Shared<std::map<std::string, Value>> *objectValue;
   };
 
   Kind kind;
@@ -133,36 +238,50 @@ private:
   std::string path;
   std::string strValue;
   NonStrValue nonStrValue;
+  // Outputs of writes with WriterOptions::cache, one per format, dropped
+  // whenever the container is modified
+  mutable std::atomic<internal::SerializationCache *> cache;
+  // Structural hash of a container, 0 until first requested
+  mutable std::atomic<uint64_t> hashValue;
 
   static const char *toString(Kind kind);
 
-  explicit Value(Kind kind, const Location &location, const std::string &path,
-                 const std::string &strValue, const NonStrValue &nonStrValue);
+  explicit Value(Kind kind, const Location &location, std::string &&path,
+                 std::string &&strValue, const NonStrValue &nonStrValue);
 
-  static Value fromBool(const Location &location, const std::string &path,
+  static Value fromBool(const Location &location, std::string &&path,
                         bool value);
 
-  static Value fromInt(const Location &location, const std::string &path,
+  static Value fromInt(const Location &location, std::string &&path,
                        int64_t value);
 
-  static Value fromFloat(const Location &location, const std::string &path,
+  static Value fromFloat(const Location &location, std::string &&path,
                          double value);
 
-  static Value fromString(const Location &location, const std::string &path,
-                          const std::string &value);
+  static Value fromString(const Location &location, std::string &&path,
+                          std::string &&value);
 
-  static Value fromNull(const Location &location, const std::string &path);
+  static Value fromNull(const Location &location, std::string &&path);
 
-  static Value fromArray(const Location &location, const std::string &path,
-                         const std::vector<Value> *arrayValue);
+  static Value fromArray(const Location &location, std::string &&path,
+                         std::vector<Value> &&items);
 
-  static Value fromObject(const Location &location, const std::string &path,
-                          const std::map<std::string, Value> *objectValue);
+  static Value fromObject(const Location &location, std::string &&path,
+                          std::map<std::string, Value> &&entries);
 
   void release();
 
+  // Items of the container for modification, copied first if shared
+  std::vector<Value> &modifiableItems();
+
+  std::map<std::string, Value> &modifiableEntries();
+
+  void invalidateCache();
+
   void ensureKind(Kind expected) const;
 
+  int compare(const Value &other) const;
+
 public:
   using iterator = std::vector<Value>::const_iterator;
 
@@ -174,6 +293,8 @@ public:
 
   static Value newString(const std::string &value);
 
+  static Value newString(std::string &&value);
+
   static Value newNull();
 
   static Value newArray();
@@ -190,6 +311,11 @@ public:
 
   ~Value();
 
+  // Copy sharing the items of containers with this value. Shared items are
+  // copied on the first modification, one level at a time, so versions of a
+  // document only take the memory of their differences.
+  Value clone() const;
+
   uint32_t getItemCount() const;
 
   const Location &getLocation() const;
@@ -230,8 +356,19 @@ public:
 
   const Value &item(const std::string &key) const;
 
+  const Value &item(const Key &key) const;
+
+  const Value &operator[](uint32_t index) const;
+
+  const Value &operator[](const Key &key) const;
+
+  // Value at path below this one, throwing like item() if it does not exist.
+  const Value &at(const Path &path) const;
+
   bool contains(const std::string &key) const;
 
+  bool contains(const Key &key) const;
+
   void add(Value &&value);
 
   void add(uint32_t index, Value &&value);
@@ -256,21 +393,1230 @@ public:
 
   bool operator!=(const Value &other) const;
 
+  // Total order over all values: kinds in declaration order, then contents.
+  // Containers compare lexicographically, objects by key and then by value.
+  bool operator<(const Value &other) const;
+
+  // Hash of the contents, ignoring locations and paths. Equal values have
+  // equal hashes. Containers keep their hash until modified.
+  uint64_t hash() const;
+
   friend std::ostream &operator<<(std::ostream &os, const Value &value);
 };
 
+// Location of a value below a root, parsed once from the syntax written by
+// Value::getPath(), e.g. ".a.b[3].c", and evaluated with Value::at(). A caching
+// path also remembers the value it resolved to in the items of the root, so
+// later lookups in the same document or its unmodified clones only compare a
+// pointer. The cache keeps those items alive until the path is evaluated on
+// another document, which makes modified documents copy them first.
+class Path {
+  friend class Value;
+  friend class Patcher;
+
+private:
+  struct Segment {
+    // Offset of the segment in the path, which ends the path of its parent
+    size_t start;
+    bool isIndex;
+    uint32_t index;
+    std::string key;
+  };
+
+  std::string text;
+  std::vector<Segment> segments;
+  bool caching;
+  // Items of the last root and the value resolved in them, only valid while
+  // the sequence is even and unchanged. Writers make it odd.
+  mutable std::atomic<uint64_t> sequence;
+  mutable std::atomic<const void *> cachedItems;
+  mutable std::atomic<bool> cachedArray;
+  mutable std::atomic<const Value *> cachedValue;
+
+  const Value *cached(const void *items) const;
+
+  void cache(const Value &root, const Value &value) const;
+
+  static void release(const void *items, bool array);
+
+public:
+  // Throws PathError if text is no valid path.
+  explicit Path(const std::string &text, bool caching = false);
+
+  // Copies the segments but not the cache.
+  Path(const Path &other);
+
+  Path &operator=(const Path &) = delete;
+
+  ~Path();
+
+  const std::string &toString() const;
+};
+
 struct Options {
   uint32_t maxDepth;
+  // Number of buffers filled by a dedicated reader thread while parsing. 0
+  // reads the stream directly on the calling thread.
+  uint32_t readAheadBuffers;
+  // Size of each read ahead buffer in bytes. 0 selects a default size.
+  uint32_t readAheadBufferSize;
+  // Parsing stops with a CancelledError once the pointed to flag is set.
+  const std::atomic<bool> *cancelled;
+  // Called with the number of consumed bytes every progressInterval bytes.
+  std::function<void(uint64_t bytes)> progress;
+  uint64_t progressInterval;
+  // Limits raising a LimitExceededError. 0 disables the respective limit.
+  uint64_t maxBytes;
+  uint32_t maxStringLength;
+  uint32_t maxItems;
+  uint64_t maxNodes;
 };
 
 extern const Options DEFAULT_OPTIONS;
 
+class Binder;
+
+// Scratch buffers of the parser that are kept between parses. Reusing a
+// context avoids all allocations apart from the ones of the resulting values.
+// A context must not be used by multiple threads at the same time.
+class ParserContext {
+  friend class Parser;
+
+private:
+  std::string text;
+  std::vector<std::vector<Value>> arrays;
+
+public:
+  ParserContext();
+
+  ParserContext(const ParserContext &) = delete;
+
+  Value parse(std::istream &stream, const Options &options = DEFAULT_OPTIONS);
+
+  void parse(std::istream &stream, Binder &binder,
+             const Options &options = DEFAULT_OPTIONS);
+};
+
 Value parse(std::istream &stream, const Options &options = DEFAULT_OPTIONS);
 
-void print(std::ostream &stream, const Value &value);
+// Hands the values of the document to binder as they are parsed instead of
+// building a Value tree.
+void parse(std::istream &stream, Binder &binder,
+           const Options &options = DEFAULT_OPTIONS);
+
+// Parses files once and hands out the same immutable document until their
+// contents change. A file whose size and modification time are unchanged is
+// not read again; otherwise a content hash decides whether it is parsed.
+// Holds at most capacity documents, dropping the least recently loaded ones.
+// If directory is set, documents are also stored there as binary snapshots
+// named by content hash, so other processes and later runs load them without
+// parsing. Safe to share between threads.
+class ParseCache {
+private:
+  struct Entry {
+    std::string fileName;
+    uint64_t size;
+    int64_t modified;
+    int64_t recorded;
+    uint64_t hash;
+    std::shared_ptr<const Value> document;
+  };
+
+  size_t capacity;
+  std::string directory;
+  Options options;
+  mutable std::mutex mutex;
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+  std::string snapshotName(uint64_t size, uint64_t hash) const;
+
+  std::shared_ptr<const Value> find(const std::string &fileName,
+                                    uint64_t size, int64_t modified,
+                                    bool checkHash, uint64_t hash);
+
+  void insert(Entry &&entry);
+
+  std::shared_ptr<const Value> parseContents(std::string &contents,
+                                             uint64_t hash);
+
+public:
+  explicit ParseCache(size_t capacity, const std::string &directory = "",
+                      const Options &options = DEFAULT_OPTIONS);
+
+  ParseCache(const ParseCache &) = delete;
+
+  // Throws std::system_error if the file cannot be read and the errors of
+  // parse() if it is invalid.
+  std::shared_ptr<const Value> load(const std::string &fileName);
+
+  void clear();
+
+  size_t size() const;
+};
+
+// Document replaced by one thread while read by many others. Readers pin the
+// current root without locks or waiting, so reloads never delay them. A
+// replaced root is destroyed once every reader that could still see it has
+// released its snapshot: publish() destroys what is safe without waiting and
+// keeps the rest for later calls. All snapshots must be released before the
+// document is destroyed.
+class SharedDocument {
+private:
+  // Reader counts of both epochs, spread over cache lines so that readers on
+  // different threads rarely touch the same one
+  struct Stripe {
+    std::atomic<uint64_t> readers[2];
+    char padding[64 - 2 * sizeof(std::atomic<uint64_t>)];
+  };
+
+  struct Retired {
+    std::unique_ptr<const Value> value;
+    uint64_t epoch;
+  };
+
+  static const size_t STRIPES = 16;
+
+  std::atomic<const Value *> root;
+  std::atomic<uint64_t> epoch;
+  mutable Stripe stripes[STRIPES];
+  std::mutex writerMutex;
+  std::vector<Retired> retired;
+
+  bool tryAdvance();
+
+  void reclaim();
+
+public:
+  class Snapshot {
+    friend SharedDocument;
+
+  private:
+    std::atomic<uint64_t> *readers;
+    const Value *value;
+
+    explicit Snapshot(std::atomic<uint64_t> *readers, const Value *value);
+
+  public:
+    Snapshot(Snapshot &&other) noexcept;
+
+    Snapshot(const Snapshot &) = delete;
+
+    ~Snapshot();
+
+    Snapshot &operator=(Snapshot &&other) noexcept;
+
+    const Value &operator*() const;
+
+    const Value *operator->() const;
+
+    const Value *get() const;
+  };
+
+  explicit SharedDocument(Value &&value);
+
+  SharedDocument(const SharedDocument &) = delete;
+
+  ~SharedDocument();
+
+  // Wait-free; the snapshot stays valid and unchanged until released.
+  Snapshot pin() const;
+
+  // Makes value the root seen by later pin() calls. Cheap clones of shared
+  // documents, e.g. from a ParseCache, can be published without copying.
+  void publish(Value &&value);
+
+  // Waits until all replaced roots are destroyed.
+  void synchronize();
+};
+
+// Stream buffer that fills a bounded ring of fixed-size buffers from a source
+// on a background thread while the consumer reads from the front buffer.
+class ReadAheadBuffer : public std::streambuf {
+public:
+  // Reads up to size bytes into buffer and returns the number of bytes read.
+  // Returning 0 signals the end of the data.
+  using Source = std::function<size_t(char *buffer, size_t size)>;
+
+  static const uint32_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+private:
+  Source source;
+  std::vector<std::vector<char>> buffers;
+  std::vector<size_t> lengths;
+  size_t readIndex;
+  size_t writeIndex;
+  size_t filled;
+  bool holding;
+  bool finished;
+  bool stopped;
+  std::exception_ptr error;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::thread thread;
+
+  void run();
+
+protected:
+  int_type underflow() override;
+
+public:
+  explicit ReadAheadBuffer(std::istream &stream, uint32_t bufferCount,
+                           uint32_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+  explicit ReadAheadBuffer(const Source &source, uint32_t bufferCount,
+                           uint32_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+  ReadAheadBuffer(const ReadAheadBuffer &) = delete;
+
+  ~ReadAheadBuffer() override;
+};
+
+#ifdef CPPCSON_WITH_ZLIB
+// Source inflating gzip or zlib compressed data read from stream in chunks.
+ReadAheadBuffer::Source gzipSource(std::istream &stream);
+
+// Parses gzip or zlib compressed data. Decompression runs on the read ahead
+// thread, so at most the read ahead buffers are held in memory.
+Value parseGzip(std::istream &stream, const Options &options = DEFAULT_OPTIONS);
+#endif
+
+#ifdef CPPCSON_WITH_ZSTD
+// Source decompressing zstd frames read from stream in chunks.
+ReadAheadBuffer::Source zstdSource(std::istream &stream);
+
+// Parses zstd compressed data. Decompression runs on the read ahead thread, so
+// at most the read ahead buffers are held in memory.
+Value parseZstd(std::istream &stream, const Options &options = DEFAULT_OPTIONS);
+#endif
+
+struct WriterOptions {
+  enum class Format {
+    // Indented multi-line CSON
+    Cson,
+    // CSON on a single line without optional whitespace
+    CompactCson,
+    // JSON on a single line without optional whitespace
+    Json
+  };
+
+  Format format;
+  // Number of threads formatting the items of large arrays and objects. 0 and
+  // 1 write on the calling thread only. The output does not depend on it.
+  uint32_t threads;
+  // Whether arrays and objects keep their formatted output until they are
+  // modified, so writing a mostly unchanged value again only formats the
+  // changed containers. Costs about the size of the output in memory.
+  bool cache;
+};
+
+extern const WriterOptions DEFAULT_WRITER_OPTIONS;
+
+// Buffered output of values in the formats of print(). Output is either
+// appended to a caller provided string or collected in an internal buffer
+// that is handed to a sink whenever it exceeds the buffer size.
+class Writer {
+  friend class Emitter;
+
+public:
+  using Sink = std::function<void(const char *data, size_t length)>;
+
+  static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+private:
+  WriterOptions options;
+  Sink sink;
+  std::string buffer;
+  std::string *output;
+  size_t flushThreshold;
+
+public:
+  explicit Writer(std::string &output,
+                  const WriterOptions &options = DEFAULT_WRITER_OPTIONS);
+
+  explicit Writer(const Sink &sink, size_t bufferSize = DEFAULT_BUFFER_SIZE,
+                  const WriterOptions &options = DEFAULT_WRITER_OPTIONS);
+
+  Writer(const Writer &) = delete;
+
+  void write(const Value &value);
+
+  // Hands buffered output to the sink. Must be called after the last write.
+  void flush();
+};
+
+void print(std::ostream &stream, const Value &value,
+           const WriterOptions &options = DEFAULT_WRITER_OPTIONS);
+
+// Returns the exact number of bytes the serialization of value takes.
+size_t serializedSize(const Value &value,
+                      const WriterOptions &options = DEFAULT_WRITER_OPTIONS);
+
+// Serializes value into buffer without any allocation and returns the number
+// of written bytes. Throws std::length_error if size is too small; sizing the
+// buffer with serializedSize() avoids that.
+size_t serializeInto(char *buffer, size_t size, const Value &value,
+                     const WriterOptions &options = DEFAULT_WRITER_OPTIONS);
+
+// Piece of serialized output. The layout matches struct iovec, so a fragment
+// list can be passed to writev().
+struct Fragment {
+  const void *data;
+  size_t length;
+};
+
+// Appends fragments that concatenate to the serialization of value.
+// Unescaped runs of strings and keys with at least minReferenceLength bytes
+// reference the storage of value directly; everything else is written to
+// storage. The fragments stay valid while value is unchanged and storage is
+// not modified.
+void serializeFragments(const Value &value, std::string &storage,
+                        std::vector<Fragment> &fragments,
+                        const WriterOptions &options = DEFAULT_WRITER_OPTIONS,
+                        size_t minReferenceLength = 64);
+
+// Writes a document piece by piece without building a Value tree, formatted
+// like print(). Keys are written in the order they are given while print()
+// sorts them. Memory use only depends on the nesting depth.
+class Emitter {
+private:
+  struct Frame {
+    bool object;
+    bool empty;
+    bool lastWasObject;
+    uint32_t indent;
+  };
+
+  Writer writer;
+  std::vector<Frame> frames;
+  bool hasKey;
+  bool complete;
+
+  void beginValue(bool object, uint32_t &indent, bool &topMost);
+
+  void endValue();
+
+  Frame &endContainer(bool object);
+
+  template <typename Write> void scalar(const Write &write);
+
+public:
+  explicit Emitter(std::string &output,
+                   const WriterOptions &options = DEFAULT_WRITER_OPTIONS);
+
+  explicit Emitter(const Writer::Sink &sink,
+                   size_t bufferSize = Writer::DEFAULT_BUFFER_SIZE,
+                   const WriterOptions &options = DEFAULT_WRITER_OPTIONS);
+
+  Emitter(const Emitter &) = delete;
+
+  void beginObject();
+
+  void endObject();
+
+  void beginArray();
+
+  void endArray();
+
+  void key(const std::string &key);
+
+  // Writes a scalar or a whole subtree.
+  void value(const Value &value);
+
+  void nullValue();
+
+  void boolValue(bool value);
+
+  void intValue(int64_t value);
+
+  void floatValue(double value);
+
+  void stringValue(const std::string &value);
+
+  // Hands buffered output to the sink. Must be called after the root value is
+  // complete.
+  void flush();
+};
+
+struct BinaryOptions {
+  // Whether locations are stored, so loaded values still refer to the parsed
+  // text
+  bool locations;
+  // Whether paths are stored. Without them, loaded values have empty paths
+  // like created ones.
+  bool paths;
+};
+
+extern const BinaryOptions DEFAULT_BINARY_OPTIONS;
+
+// Appends a versioned and checksummed binary snapshot of value to out, which
+// loads much faster than parsing the text.
+void saveBinary(std::string &out, const Value &value,
+                const BinaryOptions &options = DEFAULT_BINARY_OPTIONS);
+
+void saveBinary(std::ostream &stream, const Value &value,
+                const BinaryOptions &options = DEFAULT_BINARY_OPTIONS);
+
+// Loads a snapshot written by saveBinary(). Throws BinaryFormatError if the
+// data is no valid snapshot.
+Value loadBinary(const char *data, size_t size);
+
+Value loadBinary(std::istream &stream);
+
+class ValueView;
+
+// Read-only access to a binary snapshot in memory without deserializing it.
+// The data must outlive the view. All accesses are bounds checked, so damaged
+// data throws BinaryFormatError; verifyChecksum additionally reads the whole
+// data once to detect damage up front.
+class SnapshotView {
+  friend class BinaryReader;
+  friend class ValueView;
+
+private:
+  uint32_t flags;
+  uint32_t nodeCount;
+  uint32_t stringCount;
+  uint64_t stringDataSize;
+  const char *nodes;
+  const char *locations;
+  const char *strings;
+  const char *stringData;
+
+  const char *node(uint32_t index) const;
+
+  Value::Kind kind(uint32_t index) const;
+
+  uint64_t data(uint32_t index) const;
+
+  uint32_t items(uint32_t index, uint32_t &count) const;
+
+  const char *string(uint32_t index, uint32_t &length) const;
+
+  std::string string(uint32_t index) const;
+
+  int compareKey(uint32_t index, const char *key, size_t keyLength) const;
+
+  std::string key(uint32_t index) const;
+
+  std::string path(uint32_t index) const;
+
+  Location location(uint32_t index) const;
+
+public:
+  explicit SnapshotView(const char *data, size_t size,
+                        bool verifyChecksum = false);
+
+  ValueView root() const;
+};
+
+// Value inside a snapshot with the accessors of Value. Strings are copied
+// when requested; key lookups binary search the sorted keys in place.
+class ValueView {
+  friend class SnapshotView;
+
+private:
+  const SnapshotView *snapshot;
+  uint32_t index;
+
+  explicit ValueView(const SnapshotView *snapshot, uint32_t index);
+
+  void ensureKind(Value::Kind expected) const;
+
+  bool find(const char *key, size_t keyLength, uint32_t &found) const;
+
+public:
+  struct iterator {
+    friend ValueView;
+
+  private:
+    const SnapshotView *snapshot;
+    uint32_t index;
+
+    explicit iterator(const SnapshotView *snapshot, uint32_t index);
+
+  public:
+    bool operator==(const iterator &other) const;
+
+    bool operator!=(const iterator &other) const;
+
+    ValueView operator*() const;
+
+    iterator &operator++();
+
+    iterator operator++(int);
+  };
+
+  uint32_t getItemCount() const;
+
+  Location getLocation() const;
+
+  std::string getPath() const;
+
+  // Key of the value in its object or an empty string.
+  std::string getKey() const;
+
+  Value::Kind getKind() const;
+
+  bool isBool() const;
+
+  bool isInt() const;
+
+  bool isFloat() const;
+
+  bool isString() const;
+
+  bool isNull() const;
+
+  bool isArray() const;
+
+  bool isObject() const;
+
+  bool asBool() const;
+
+  int64_t asInt() const;
+
+  double asFloat() const;
+
+  std::string asString() const;
+
+  ValueView asNull() const;
+
+  ValueView asArray() const;
+
+  ValueView asObject() const;
+
+  ValueView item(uint32_t index) const;
+
+  ValueView item(const std::string &key) const;
+
+  ValueView item(const Key &key) const;
+
+  ValueView operator[](uint32_t index) const;
+
+  ValueView operator[](const Key &key) const;
+
+  bool contains(const std::string &key) const;
+
+  bool contains(const Key &key) const;
+
+  std::vector<std::string> keys() const;
+
+  // Iterates the items of arrays and objects, which are sorted by key.
+  iterator begin() const;
+
+  iterator end() const;
+
+  // Deserializes the value and everything below it.
+  Value toValue() const;
+};
+
+// Snapshot file mapped into memory, so processes opening the same file share
+// its pages. Systems without mmap() read the file instead.
+class MappedSnapshot {
+private:
+  class Mapping {
+  public:
+    const char *data;
+    size_t size;
+    bool mapped;
+    std::vector<char> buffer;
+
+    explicit Mapping(const std::string &fileName);
+
+    Mapping(const Mapping &) = delete;
+
+    ~Mapping();
+  };
+
+  Mapping mapping;
+  SnapshotView snapshot;
+
+public:
+  explicit MappedSnapshot(const std::string &fileName,
+                          bool verifyChecksum = false);
+
+  MappedSnapshot(const MappedSnapshot &) = delete;
+
+  ValueView root() const;
+};
+
+// Change of the value at a path written like Value::getPath()
+struct PatchOperation {
+  enum class Kind { Add, Remove, Replace };
+
+  Kind kind;
+  std::string path;
+  // Added or new value, null for Remove
+  Value value;
+};
+
+// Operations turning from into to when applied in order. Object keys are
+// merged in their sorted order and array items are compared by index.
+// Containers sharing their items with clones or having equal hashes are
+// skipped. Hashes stay cached, so diffing against the same value again only
+// traverses the changed branches.
+std::vector<PatchOperation> diff(const Value &from, const Value &to);
+
+// Applies the operations in order. Add inserts into arrays and adds new keys
+// to objects; Remove and Replace require the path to exist. Only containers
+// on the paths are modified, which copies them if shared with clones.
+void apply(Value &value, const std::vector<PatchOperation> &patch);
+
+#ifdef CPPCSON_WITH_INOTIFY
+struct FileChange {
+  std::string fileName;
+  // New document, null if the file was removed
+  std::shared_ptr<const Value> document;
+  // Document before the change, null if the file was not loaded before
+  std::shared_ptr<const Value> previous;
+  // Turns previous into document, empty if either of them is null
+  std::vector<PatchOperation> patch;
+  // Set if the file could not be read or parsed, document is then previous
+  std::exception_ptr error;
+};
+
+// Watches .cson files with inotify and reloads them on a background thread
+// once writes have paused for the debounce interval. Only files that changed
+// are read, and only files whose contents changed are parsed and reported.
+// Files are watched through their directories, so files replaced by renaming
+// stay watched.
+class FileWatcher {
+public:
+  // Called on the background thread, must not throw.
+  using Callback = std::function<void(const FileChange &change)>;
+
+private:
+  struct Directory {
+    std::string path;
+    // Whether all .cson files in the directory are watched
+    bool all;
+    // Reported file names of individually watched files by name
+    std::map<std::string, std::string> files;
+
+    std::string fileName(const std::string &name) const;
+  };
+
+  struct File {
+    // Compared instead of a hash, so that no edit is mistaken for none
+    std::shared_ptr<const std::string> contents;
+    std::shared_ptr<const Value> document;
+  };
+
+  Callback callback;
+  std::chrono::milliseconds debounce;
+  Options options;
+  int inotifyDescriptor;
+  int wakeDescriptor;
+  mutable std::mutex mutex;
+  std::unordered_map<int, Directory> directories;
+  std::map<std::string, File> files;
+  std::thread thread;
+
+  int addDirectory(const std::string &path);
+
+  bool load(const std::string &fileName, FileChange &change);
+
+  void reload(const std::string &fileName);
+
+  void readEvents(
+      std::map<std::string, std::chrono::steady_clock::time_point> &pending);
+
+  void run();
+
+public:
+  explicit FileWatcher(Callback callback, uint32_t debounceMilliseconds = 50,
+                       const Options &options = DEFAULT_OPTIONS);
+
+  FileWatcher(const FileWatcher &) = delete;
+
+  ~FileWatcher();
+
+  // Watches a file or all .cson files directly in a directory. The files are
+  // loaded right away, throwing if one cannot be read or parsed.
+  void watch(const std::string &path);
+
+  // Last successfully loaded document of a watched file, null if none.
+  std::shared_ptr<const Value> document(const std::string &fileName) const;
+};
+#endif
+
+// Parser state handed to binders while decoding a document.
+class Decoder {
+public:
+  virtual ~Decoder();
+
+  // Decodes the current item or entry; at most once per item or entry.
+  virtual Location decode(Binder &binder) = 0;
+
+  // Path of the current value, written like Value::getPath()
+  virtual const std::string &path() const = 0;
+};
+
+// Receives the values of a document while it is parsed.
+class Binder {
+protected:
+  [[noreturn]] void mismatch(const Decoder &decoder, Value::Kind actual,
+                             const Location &location) const;
+
+public:
+  virtual ~Binder();
+
+  // Kind named in type errors
+  virtual Value::Kind expected() const = 0;
+
+  virtual void bindNull(Decoder &decoder, const Location &location);
+
+  virtual void bindBool(Decoder &decoder, bool value,
+                        const Location &location);
+
+  virtual void bindInt(Decoder &decoder, int64_t value,
+                       const Location &location);
+
+  virtual void bindFloat(Decoder &decoder, double value,
+                         const Location &location);
+
+  virtual void bindString(Decoder &decoder, std::string &&value,
+                          const Location &location);
+
+  virtual void beginArray(Decoder &decoder, const Location &location);
+
+  // Skips the item unless decoder.decode() is called
+  virtual void bindItem(Decoder &decoder, uint32_t index);
+
+  // location covers the whole array
+  virtual void endArray(Decoder &decoder, const Location &location);
+
+  virtual void beginObject(Decoder &decoder, const Location &location);
+
+  // Skips the entry unless decoder.decode() is called
+  virtual void bindEntry(Decoder &decoder, const std::string &key);
+
+  // location covers the whole object
+  virtual void endObject(Decoder &decoder, const Location &location);
+};
+
+template <typename T, typename Enable = void> class Binding;
+
+namespace internal {
+template <typename T> struct FieldBase {
+  std::string key;
+  bool required;
+
+  explicit FieldBase(std::string &&key, bool required)
+      : key(std::move(key)), required(required) {}
+
+  virtual ~FieldBase() = default;
+
+  virtual void decode(Decoder &decoder, T &target) const = 0;
+
+  virtual void encode(Emitter &emitter, const T &source) const = 0;
+};
+
+template <typename T, typename Member> struct Field : FieldBase<T> {
+  Member T::*member;
+
+  explicit Field(std::string &&key, Member T::*member, bool required)
+      : FieldBase<T>(std::move(key), required), member(member) {}
+
+  void decode(Decoder &decoder, T &target) const override {
+    Binding<Member> binding(target.*member);
+    decoder.decode(binding);
+  }
+
+  void encode(Emitter &emitter, const T &source) const override {
+    Binding<Member>::encode(emitter, source.*member);
+  }
+};
+
+template <typename T> bool fitsInteger(int64_t value) {
+  if (std::is_signed<T>::value) {
+    return value >= static_cast<int64_t>(std::numeric_limits<T>::min()) &&
+           value <= static_cast<int64_t>(std::numeric_limits<T>::max());
+  }
+
+  return value >= 0 && static_cast<uint64_t>(value) <=
+                           static_cast<uint64_t>(std::numeric_limits<T>::max());
+}
+} // namespace internal
+
+// Fields of a struct T, sorted by key.
+template <typename T> class FieldList {
+private:
+  std::vector<std::unique_ptr<internal::FieldBase<T>>> fields;
+
+  template <typename Member>
+  FieldList &insert(std::string &&key, Member T::*member, bool required) {
+    std::unique_ptr<internal::FieldBase<T>> field(
+        new internal::Field<T, Member>(std::move(key), member, required));
+    fields.insert(fields.begin() + static_cast<ptrdiff_t>(find(field->key)),
+                  std::move(field));
+    return *this;
+  }
+
+public:
+  template <typename Member>
+  FieldList &add(std::string key, Member T::*member) {
+    return insert(std::move(key), member, true);
+  }
+
+  // Adds a field that keeps its value if missing.
+  template <typename Member>
+  FieldList &optional(std::string key, Member T::*member) {
+    return insert(std::move(key), member, false);
+  }
+
+  size_t size() const { return fields.size(); }
+
+  const internal::FieldBase<T> &operator[](size_t index) const {
+    return *fields[index];
+  }
+
+  size_t find(const std::string &key) const {
+    auto itr = std::lower_bound(
+        fields.begin(), fields.end(), key,
+        [](const std::unique_ptr<internal::FieldBase<T>> &field,
+           const std::string &key) { return field->key < key; });
+    return static_cast<size_t>(itr - fields.begin());
+  }
+};
+
+// Specialized with a static describe(FieldList<T> &) to make structs bindable
+template <typename T> struct Fields;
+
+#define CPPCSON_FIELD(Type, member) #member, &Type::member
+
+// Unknown keys are skipped.
+template <typename T, typename Enable> class Binding : public Binder {
+private:
+  T &target;
+  std::vector<bool> found;
+
+  static FieldList<T> describe() {
+    FieldList<T> fields;
+    Fields<T>::describe(fields);
+    return fields;
+  }
+
+  static const FieldList<T> &fields() {
+    static const FieldList<T> list(describe());
+    return list;
+  }
+
+public:
+  explicit Binding(T &target) : target(target) {}
+
+  Value::Kind expected() const override { return Value::Kind::Object; }
+
+  void beginObject(Decoder &, const Location &) override {
+    found.assign(fields().size(), false);
+  }
+
+  void bindEntry(Decoder &decoder, const std::string &key) override {
+    auto &list = fields();
+    auto index = list.find(key);
+    if (index < list.size() && list[index].key == key) {
+      found[index] = true;
+      list[index].decode(decoder, target);
+    }
+  }
+
+  void endObject(Decoder &decoder, const Location &location) override {
+    auto &list = fields();
+    for (size_t i = 0; i < list.size(); ++i) {
+      if (list[i].required && !found[i]) {
+        throw MissingKeyError(list[i].key, decoder.path(), location);
+      }
+    }
+  }
+
+  static void encode(Emitter &emitter, const T &source) {
+    auto &list = fields();
+
+    emitter.beginObject();
+    for (size_t i = 0; i < list.size(); ++i) {
+      emitter.key(list[i].key);
+      list[i].encode(emitter, source);
+    }
+    emitter.endObject();
+  }
+};
+
+template <> class Binding<bool> : public Binder {
+private:
+  bool &target;
+
+public:
+  explicit Binding(bool &target) : target(target) {}
+
+  Value::Kind expected() const override { return Value::Kind::Bool; }
+
+  void bindBool(Decoder &, bool value, const Location &) override {
+    target = value;
+  }
+
+  static void encode(Emitter &emitter, bool source) {
+    emitter.boolValue(source);
+  }
+};
+
+// Throws LimitExceededError outside the range of T, or int64_t when encoding.
+template <typename T>
+class Binding<T, typename std::enable_if<std::is_integral<T>::value &&
+                                         !std::is_same<T, bool>::value>::type>
+    : public Binder {
+private:
+  T &target;
+
+public:
+  explicit Binding(T &target) : target(target) {}
+
+  Value::Kind expected() const override { return Value::Kind::Int; }
+
+  void bindInt(Decoder &, int64_t value, const Location &location) override {
+    if (!internal::fitsInteger<T>(value)) {
+      throw LimitExceededError("Integer exceeds the range of the bound type",
+                               location);
+    }
+
+    target = static_cast<T>(value);
+  }
+
+  static void encode(Emitter &emitter, T source) {
+    if (std::is_unsigned<T>::value &&
+        static_cast<uint64_t>(source) >
+            static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+      throw LimitExceededError("Integer exceeds the range of int64_t",
+                               Location::unknown());
+    }
+
+    emitter.intValue(static_cast<int64_t>(source));
+  }
+};
+
+template <typename T>
+class Binding<T,
+              typename std::enable_if<std::is_floating_point<T>::value>::type>
+    : public Binder {
+private:
+  T &target;
+
+public:
+  explicit Binding(T &target) : target(target) {}
+
+  Value::Kind expected() const override { return Value::Kind::Float; }
+
+  void bindInt(Decoder &, int64_t value, const Location &) override {
+    target = static_cast<T>(value);
+  }
+
+  void bindFloat(Decoder &, double value, const Location &) override {
+    target = static_cast<T>(value);
+  }
+
+  static void encode(Emitter &emitter, T source) {
+    emitter.floatValue(static_cast<double>(source));
+  }
+};
+
+template <> class Binding<std::string> : public Binder {
+private:
+  std::string &target;
+
+public:
+  explicit Binding(std::string &target) : target(target) {}
+
+  Value::Kind expected() const override { return Value::Kind::String; }
+
+  void bindString(Decoder &, std::string &&value, const Location &) override {
+    target = std::move(value);
+  }
+
+  static void encode(Emitter &emitter, const std::string &source) {
+    emitter.stringValue(source);
+  }
+};
+
+template <typename T> class Binding<std::vector<T>> : public Binder {
+private:
+  std::vector<T> &target;
+
+public:
+  explicit Binding(std::vector<T> &target) : target(target) {}
+
+  Value::Kind expected() const override { return Value::Kind::Array; }
+
+  void beginArray(Decoder &, const Location &) override { target.clear(); }
+
+  void bindItem(Decoder &decoder, uint32_t) override {
+    target.emplace_back();
+    Binding<T> binding(target.back());
+    decoder.decode(binding);
+  }
+
+  static void encode(Emitter &emitter, const std::vector<T> &source) {
+    emitter.beginArray();
+    for (auto &item : source) {
+      Binding<T>::encode(emitter, item);
+    }
+    emitter.endArray();
+  }
+};
+
+// std::vector<bool> stores bits, so items are decoded into a bool first.
+template <> class Binding<std::vector<bool>> : public Binder {
+private:
+  std::vector<bool> &target;
+
+public:
+  explicit Binding(std::vector<bool> &target) : target(target) {}
+
+  Value::Kind expected() const override { return Value::Kind::Array; }
+
+  void beginArray(Decoder &, const Location &) override { target.clear(); }
+
+  void bindItem(Decoder &decoder, uint32_t) override {
+    bool item = false;
+    Binding<bool> binding(item);
+    decoder.decode(binding);
+    target.push_back(item);
+  }
+
+  static void encode(Emitter &emitter, const std::vector<bool> &source) {
+    emitter.beginArray();
+    for (bool item : source) {
+      emitter.boolValue(item);
+    }
+    emitter.endArray();
+  }
+};
+
+// Later duplicate keys replace earlier ones like in parsed values.
+template <typename T> class Binding<std::map<std::string, T>> : public Binder {
+private:
+  std::map<std::string, T> &target;
+
+public:
+  explicit Binding(std::map<std::string, T> &target) : target(target) {}
+
+  Value::Kind expected() const override { return Value::Kind::Object; }
+
+  void beginObject(Decoder &, const Location &) override { target.clear(); }
+
+  void bindEntry(Decoder &decoder, const std::string &key) override {
+    auto &value = target[key];
+    value = T();
+    Binding<T> binding(value);
+    decoder.decode(binding);
+  }
+
+  static void encode(Emitter &emitter, const std::map<std::string, T> &source) {
+    emitter.beginObject();
+    for (auto &entry : source) {
+      emitter.key(entry.first);
+      Binding<T>::encode(emitter, entry.second);
+    }
+    emitter.endObject();
+  }
+};
+
+template <typename T>
+void decode(std::istream &stream, T &target,
+            const Options &options = DEFAULT_OPTIONS) {
+  Binding<T> binding(target);
+  parse(stream, binding, options);
+}
+
+template <typename T> void encode(Emitter &emitter, const T &source) {
+  Binding<T>::encode(emitter, source);
+}
+
+template <typename T>
+std::string encode(const T &source,
+                   const WriterOptions &options = DEFAULT_WRITER_OPTIONS) {
+  std::string output;
+  Emitter emitter(output, options);
+  encode(emitter, source);
+  emitter.flush();
+  return output;
+}
+
+// Violation of a schema by the value at path
+struct Violation {
+  std::string path;
+  std::string message;
+  Location location;
+};
+
+// Checks values against a schema that is itself a value, e.g. parsed from
+//
+//   type: 'object'
+//   required: ['host']
+//   properties:
+//     host: {type: 'string'}
+//     port: {type: 'integer', minimum: 1, maximum: 65535}
+//     mode: {enum: ['fast', 'safe']}
+//
+// Supported keywords are type (a kind name like in TypeError, "number" or a
+// list of them), enum (scalars only), minimum, maximum, minItems, maxItems,
+// required, properties, additionalProperties (a schema or a bool) and items.
+// Other keywords are ignored. The schema is compiled into a flat list of
+// rules once; validation then collects all violations in a single pass.
+class Schema {
+private:
+  class Checker;
+  class StreamChecker;
+
+  struct Rule {
+    // Bit per accepted Value::Kind
+    uint32_t kinds;
+    bool hasMinimum;
+    bool hasMaximum;
+    double minimum;
+    double maximum;
+    uint32_t minItems;
+    uint32_t maxItems;
+    // Sorted, any value if empty
+    std::vector<Value> allowed;
+    // Sorted
+    std::vector<std::string> required;
+    // Rules of object entries, sorted by key
+    std::vector<std::pair<std::string, size_t>> properties;
+    // Rules of array items and of object entries without a property
+    size_t items;
+    size_t additional;
+  };
+
+  std::vector<Rule> rules;
+
+  static const char *kindName(Value::Kind kind);
+
+  size_t compile(const Value &definition);
+
+public:
+  // Throws TypeError or SchemaError if definition is no valid schema.
+  explicit Schema(const Value &definition);
+
+  std::vector<Violation> validate(const Value &value) const;
+
+  // Validates a document while it is parsed, without building a Value tree.
+  // Violations are reported in document order instead of key order. Syntax
+  // errors are thrown.
+  std::vector<Violation>
+  validate(std::istream &stream,
+           const Options &options = DEFAULT_OPTIONS) const;
+};
 
 std::string escapeKey(const std::string &str);
 
 std::string escape(const std::string &str);
 
 } // namespace cppcson
+
+namespace std {
+template <> struct hash<cppcson::Value> {
+  size_t operator()(const cppcson::Value &value) const {
+    return static_cast<size_t>(value.hash());
+  }
+};
+} // namespace std
@@ -0,0 +1,892 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <system_error>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CPPCSON_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Layout of a binary snapshot, all integers little-endian:
+//
+// Header (48 bytes)
+//   char[8]  magic "CPPCSONB"
+//   uint32   version
+//   uint32   flags (1 = locations, 2 = paths)
+//   uint32   number of nodes
+//   uint32   number of strings
+//   uint64   size of the string data
+//   uint64   size of the payload following the header
+//   uint64   checksum of the payload
+//
+// Payload
+//   Nodes (24 bytes each) in breadth-first order, the root first:
+//     uint32 kind (order of Value::Kind)
+//     uint32 string index of the key in the parent object or NO_STRING
+//     uint64 bool, int or float bits, string index for strings or index of
+//            the first item for arrays and objects
+//     uint32 number of items
+//     uint32 string index of the path or NO_STRING
+//   Locations (16 bytes each, if flagged): start line and column, end line
+//   and column of every node
+//   Strings (8 bytes each): uint32 offset and length in the string data
+//   String data
+//
+// The items of a container are consecutive nodes, object items are sorted by
+// key.
+
+namespace cppcson {
+
+static const char BINARY_MAGIC[8] = {'C', 'P', 'P', 'C', 'S', 'O', 'N', 'B'};
+static const uint32_t BINARY_VERSION = 2;
+
+static const uint32_t FLAG_LOCATIONS = 1;
+static const uint32_t FLAG_PATHS = 2;
+
+static const size_t HEADER_SIZE = 48;
+static const size_t NODE_SIZE = 24;
+static const size_t LOCATION_SIZE = 16;
+static const size_t STRING_SIZE = 8;
+
+static const uint32_t NO_STRING = 0xFFFFFFFF;
+
+static void storeU32(char *pos, uint32_t value) {
+  for (auto i = 0; i < 4; ++i) {
+    pos[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+static void storeU64(char *pos, uint64_t value) {
+  for (auto i = 0; i < 8; ++i) {
+    pos[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+static uint32_t loadU32(const char *pos) {
+  uint32_t value = 0;
+  for (auto i = 0; i < 4; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(pos[i])) << (8 * i);
+  }
+  return value;
+}
+
+static uint64_t loadU64(const char *pos) {
+  uint64_t value = 0;
+  for (auto i = 0; i < 8; ++i) {
+    value |= static_cast<uint64_t>(static_cast<uint8_t>(pos[i])) << (8 * i);
+  }
+  return value;
+}
+
+uint64_t internal::hashBytes(const char *data, size_t length) {
+  // Seeded with the length, so that trailing zero bytes change the hash
+  auto hash = mixBits(static_cast<uint64_t>(length));
+  size_t pos = 0;
+
+  for (; pos + 8 <= length; pos += 8) {
+    hash = mixBits(hash ^ loadU64(data + pos));
+  }
+
+  if (pos < length) {
+    uint64_t tail = 0;
+    for (auto shift = 0u; pos < length; ++pos, shift += 8) {
+      tail |= static_cast<uint64_t>(static_cast<uint8_t>(data[pos])) << shift;
+    }
+    hash = mixBits(hash ^ tail);
+  }
+
+  return hash;
+}
+
+const BinaryOptions DEFAULT_BINARY_OPTIONS = {true, true};
+
+class BinaryWriter {
+private:
+  const BinaryOptions &options;
+  std::vector<const Value *> nodes;
+  std::vector<const std::string *> keys;
+  std::unordered_map<std::string, uint32_t> stringIndexes;
+  std::vector<std::pair<uint32_t, uint32_t>> strings;
+  std::string stringData;
+
+  uint32_t addString(const std::string &str) {
+    if (stringData.length() + str.length() > 0xFFFFFFFF) {
+      throw BinaryFormatError("Too much string data for a binary snapshot");
+    }
+
+    strings.emplace_back(static_cast<uint32_t>(stringData.length()),
+                         static_cast<uint32_t>(str.length()));
+    stringData += str;
+    return static_cast<uint32_t>(strings.size() - 1);
+  }
+
+  // Keys and strings repeat often, so they are stored once
+  uint32_t addSharedString(const std::string &str) {
+    auto itr = stringIndexes.find(str);
+    if (itr != stringIndexes.end()) {
+      return itr->second;
+    }
+
+    auto index = addString(str);
+    stringIndexes.emplace(str, index);
+    return index;
+  }
+
+public:
+  explicit BinaryWriter(const BinaryOptions &options) : options(options) {}
+
+  void write(std::string &out, const Value &value) {
+    nodes.push_back(&value);
+    keys.push_back(nullptr);
+
+    // The node list is the queue of the breadth-first traversal
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      auto node = nodes[i];
+
+      if (node->kind == Value::Kind::Array) {
+        for (auto &item : node->nonStrValue.arrayValue->items) {
+          nodes.push_back(&item);
+          keys.push_back(nullptr);
+        }
+      } else if (node->kind == Value::Kind::Object) {
+        for (auto &entry : node->nonStrValue.objectValue->items) {
+          nodes.push_back(&entry.second);
+          keys.push_back(&entry.first);
+        }
+      }
+    }
+
+    if (nodes.size() > 0xFFFFFFFF) {
+      throw BinaryFormatError("Too many values for a binary snapshot");
+    }
+
+    auto flags = (options.locations ? FLAG_LOCATIONS : 0) |
+                 (options.paths ? FLAG_PATHS : 0);
+    auto nodesSize = nodes.size() * NODE_SIZE;
+    auto locationsSize = options.locations ? nodes.size() * LOCATION_SIZE : 0;
+
+    auto start = out.length();
+    out.resize(start + HEADER_SIZE + nodesSize + locationsSize);
+
+    auto pos = &out[start + HEADER_SIZE];
+    auto locationPos = pos + nodesSize;
+    uint64_t nextChild = 1;
+
+    for (size_t i = 0; i < nodes.size(); ++i, pos += NODE_SIZE) {
+      auto node = nodes[i];
+      uint64_t data = 0;
+      uint32_t count = node->getItemCount();
+
+      switch (node->kind) {
+      case Value::Kind::Bool:
+        data = node->nonStrValue.boolValue ? 1 : 0;
+        break;
+      case Value::Kind::Int:
+        data = static_cast<uint64_t>(node->nonStrValue.intValue);
+        break;
+      case Value::Kind::Float:
+        std::memcpy(&data, &node->nonStrValue.floatValue, sizeof(data));
+        break;
+      case Value::Kind::String:
+        data = addSharedString(node->strValue);
+        break;
+      case Value::Kind::Array:
+      case Value::Kind::Object:
+        data = nextChild;
+        nextChild += count;
+        break;
+      default:
+        break;
+      }
+
+      storeU32(pos, static_cast<uint32_t>(node->kind));
+      storeU32(pos + 4,
+               keys[i] != nullptr ? addSharedString(*keys[i]) : NO_STRING);
+      storeU64(pos + 8, data);
+      storeU32(pos + 16, count);
+      storeU32(pos + 20, options.paths ? addString(node->path) : NO_STRING);
+
+      if (options.locations) {
+        auto &location = node->location;
+        storeU32(locationPos, location.getStartLine());
+        storeU32(locationPos + 4, location.getStartColumn());
+        storeU32(locationPos + 8, location.getEndLine());
+        storeU32(locationPos + 12, location.getEndColumn());
+        locationPos += LOCATION_SIZE;
+      }
+    }
+
+    auto stringsStart = out.length();
+    out.resize(stringsStart + strings.size() * STRING_SIZE);
+
+    pos = &out[stringsStart];
+    for (auto &str : strings) {
+      storeU32(pos, str.first);
+      storeU32(pos + 4, str.second);
+      pos += STRING_SIZE;
+    }
+
+    out += stringData;
+
+    auto header = &out[start];
+    auto payloadSize = out.length() - start - HEADER_SIZE;
+    std::memcpy(header, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    storeU32(header + 8, BINARY_VERSION);
+    storeU32(header + 12, flags);
+    storeU32(header + 16, static_cast<uint32_t>(nodes.size()));
+    storeU32(header + 20, static_cast<uint32_t>(strings.size()));
+    storeU64(header + 24, stringData.length());
+    storeU64(header + 32, payloadSize);
+    storeU64(header + 40,
+             internal::hashBytes(header + HEADER_SIZE, payloadSize));
+  }
+};
+
+[[noreturn]] static void fail(const std::string &message) {
+  throw BinaryFormatError("Invalid binary snapshot: " + message);
+}
+
+SnapshotView::SnapshotView(const char *data, size_t size,
+                           bool verifyChecksum) {
+  if (size < HEADER_SIZE ||
+      std::memcmp(data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0) {
+    fail("missing header");
+  }
+
+  if (loadU32(data + 8) != BINARY_VERSION) {
+    fail("unsupported version " + std::to_string(loadU32(data + 8)));
+  }
+
+  flags = loadU32(data + 12);
+  if ((flags & ~(FLAG_LOCATIONS | FLAG_PATHS)) != 0) {
+    fail("unknown flags");
+  }
+
+  nodeCount = loadU32(data + 16);
+  stringCount = loadU32(data + 20);
+  stringDataSize = loadU64(data + 24);
+  auto payloadSize = loadU64(data + 32);
+
+  if (payloadSize != size - HEADER_SIZE) {
+    fail("payload size mismatch");
+  }
+
+  auto payload = data + HEADER_SIZE;
+  if (verifyChecksum &&
+      internal::hashBytes(payload, payloadSize) != loadU64(data + 40)) {
+    fail("checksum mismatch");
+  }
+
+  uint64_t locationsSize =
+      (flags & FLAG_LOCATIONS) != 0 ? uint64_t(nodeCount) * LOCATION_SIZE : 0;
+
+  // Each section is checked against the bytes left, as a sum could wrap
+  auto remaining = payloadSize;
+  for (auto sectionSize : {uint64_t(nodeCount) * NODE_SIZE, locationsSize,
+                           uint64_t(stringCount) * STRING_SIZE}) {
+    if (sectionSize > remaining) {
+      fail("section sizes mismatch");
+    }
+    remaining -= sectionSize;
+  }
+
+  if (nodeCount == 0 || stringDataSize != remaining) {
+    fail("section sizes mismatch");
+  }
+
+  nodes = payload;
+  locations = nodes + nodeCount * NODE_SIZE;
+  strings = locations + locationsSize;
+  stringData = strings + stringCount * STRING_SIZE;
+}
+
+const char *SnapshotView::node(uint32_t index) const {
+  if (index >= nodeCount) {
+    fail("value index out of range");
+  }
+
+  return nodes + index * NODE_SIZE;
+}
+
+Value::Kind SnapshotView::kind(uint32_t index) const {
+  auto kind = loadU32(node(index));
+  if (kind > static_cast<uint32_t>(Value::Kind::Object)) {
+    fail("unknown kind");
+  }
+
+  return static_cast<Value::Kind>(kind);
+}
+
+uint64_t SnapshotView::data(uint32_t index) const {
+  return loadU64(node(index) + 8);
+}
+
+uint32_t SnapshotView::items(uint32_t index, uint32_t &count) const {
+  auto pos = node(index);
+  auto first = loadU64(pos + 8);
+  count = loadU32(pos + 16);
+
+  // Items always follow their container, so walking down always ends
+  if (first <= index || first + count > nodeCount) {
+    fail("item index out of range");
+  }
+
+  return static_cast<uint32_t>(first);
+}
+
+const char *SnapshotView::string(uint32_t index, uint32_t &length) const {
+  if (index >= stringCount) {
+    fail("string index out of range");
+  }
+
+  auto entry = strings + index * STRING_SIZE;
+  auto offset = loadU32(entry);
+  length = loadU32(entry + 4);
+
+  if (uint64_t(offset) + length > stringDataSize) {
+    fail("string out of range");
+  }
+
+  return stringData + offset;
+}
+
+std::string SnapshotView::string(uint32_t index) const {
+  if (index == NO_STRING) {
+    return std::string();
+  }
+
+  uint32_t length;
+  auto data = string(index, length);
+  return std::string(data, length);
+}
+
+int SnapshotView::compareKey(uint32_t index, const char *key,
+                             size_t keyLength) const {
+  auto keyIndex = loadU32(node(index) + 4);
+  if (keyIndex == NO_STRING) {
+    fail("missing key");
+  }
+
+  uint32_t length;
+  auto data = string(keyIndex, length);
+
+  // Same order as std::string, which sorted the keys when saving
+  auto result = std::char_traits<char>::compare(
+      data, key, std::min<size_t>(length, keyLength));
+  if (result != 0) {
+    return result;
+  }
+
+  return length < keyLength ? -1 : length > keyLength ? 1 : 0;
+}
+
+std::string SnapshotView::key(uint32_t index) const {
+  return string(loadU32(node(index) + 4));
+}
+
+std::string SnapshotView::path(uint32_t index) const {
+  return (flags & FLAG_PATHS) != 0 ? string(loadU32(node(index) + 20))
+                                   : std::string();
+}
+
+Location SnapshotView::location(uint32_t index) const {
+  if ((flags & FLAG_LOCATIONS) == 0) {
+    return Location::unknown();
+  }
+
+  node(index);
+
+  auto pos = locations + index * LOCATION_SIZE;
+  return Location(loadU32(pos), loadU32(pos + 4), loadU32(pos + 8),
+                  loadU32(pos + 12));
+}
+
+ValueView SnapshotView::root() const { return ValueView(this, 0); }
+
+class BinaryReader {
+private:
+  struct Frame {
+    uint32_t node;
+    uint32_t next;
+    uint32_t end;
+    std::unique_ptr<std::vector<Value>> items;
+    std::unique_ptr<std::map<std::string, Value>> entries;
+  };
+
+  const SnapshotView &snapshot;
+  uint32_t builtCount;
+
+  bool isContainer(uint32_t index) const {
+    auto kind = snapshot.kind(index);
+    return kind == Value::Kind::Array || kind == Value::Kind::Object;
+  }
+
+  Value scalar(uint32_t index) const {
+    auto data = snapshot.data(index);
+
+    switch (snapshot.kind(index)) {
+    case Value::Kind::Bool:
+      if (data > 1) {
+        fail("invalid bool");
+      }
+      return Value::fromBool(snapshot.location(index), snapshot.path(index),
+                             data != 0);
+    case Value::Kind::Int:
+      return Value::fromInt(snapshot.location(index), snapshot.path(index),
+                            static_cast<int64_t>(data));
+    case Value::Kind::Float: {
+      double value;
+      std::memcpy(&value, &data, sizeof(value));
+      return Value::fromFloat(snapshot.location(index), snapshot.path(index),
+                              value);
+    }
+    case Value::Kind::String:
+      if (data >= NO_STRING) {
+        fail("string index out of range");
+      }
+      return Value::fromString(snapshot.location(index), snapshot.path(index),
+                               snapshot.string(static_cast<uint32_t>(data)));
+    // Only empty containers are built here
+    case Value::Kind::Array:
+      return Value::fromArray(snapshot.location(index), snapshot.path(index),
+                              std::vector<Value>());
+    case Value::Kind::Object:
+      return Value::fromObject(snapshot.location(index), snapshot.path(index),
+                               std::map<std::string, Value>());
+    default:
+      return Value::fromNull(snapshot.location(index), snapshot.path(index));
+    }
+  }
+
+  Value container(Frame &frame) const {
+    if (frame.items) {
+      return Value::fromArray(snapshot.location(frame.node),
+                              snapshot.path(frame.node),
+                              std::move(*frame.items));
+    }
+
+    return Value::fromObject(snapshot.location(frame.node),
+                             snapshot.path(frame.node),
+                             std::move(*frame.entries));
+  }
+
+  void addItem(Frame &frame, uint32_t index, Value &&value) {
+    // Damaged snapshots may share items between containers, which must not
+    // multiply the size of the result
+    if (++builtCount > snapshot.nodeCount) {
+      fail("shared items");
+    }
+
+    if (frame.items) {
+      frame.items->push_back(std::move(value));
+      return;
+    }
+
+    auto key = snapshot.key(index);
+    if (!frame.entries->empty() && !(frame.entries->rbegin()->first < key)) {
+      fail("unsorted keys");
+    }
+
+    // Keys are sorted, so every entry is appended at the end
+    frame.entries->emplace_hint(frame.entries->end(), std::move(key),
+                                std::move(value));
+  }
+
+  Frame frame(uint32_t index) const {
+    uint32_t count;
+    auto first = snapshot.items(index, count);
+
+    Frame frame{index, first, first + count, nullptr, nullptr};
+    if (snapshot.kind(index) == Value::Kind::Array) {
+      frame.items.reset(new std::vector<Value>());
+      frame.items->reserve(count);
+    } else {
+      frame.entries.reset(new std::map<std::string, Value>());
+    }
+
+    return frame;
+  }
+
+  bool hasItems(uint32_t index) const {
+    return isContainer(index) && loadU32(snapshot.node(index) + 16) != 0;
+  }
+
+public:
+  explicit BinaryReader(const SnapshotView &snapshot)
+      : snapshot(snapshot), builtCount(0) {}
+
+  Value read(uint32_t index) {
+    if (!hasItems(index)) {
+      return scalar(index);
+    }
+
+    // Depth-first with an explicit stack, so deep documents cannot overflow
+    // the call stack
+    std::vector<Frame> frames;
+    frames.push_back(frame(index));
+
+    while (true) {
+      auto &top = frames.back();
+
+      if (top.next == top.end) {
+        auto value = container(top);
+        auto node = top.node;
+        frames.pop_back();
+
+        if (frames.empty()) {
+          return value;
+        }
+
+        addItem(frames.back(), node, std::move(value));
+        continue;
+      }
+
+      auto item = top.next++;
+      if (hasItems(item)) {
+        frames.push_back(frame(item));
+      } else {
+        addItem(top, item, scalar(item));
+      }
+    }
+  }
+};
+
+ValueView::iterator::iterator(const SnapshotView *snapshot, uint32_t index)
+    : snapshot(snapshot), index(index) {}
+
+bool ValueView::iterator::operator==(const iterator &other) const {
+  return index == other.index && snapshot == other.snapshot;
+}
+
+bool ValueView::iterator::operator!=(const iterator &other) const {
+  return !(*this == other);
+}
+
+ValueView ValueView::iterator::operator*() const {
+  return ValueView(snapshot, index);
+}
+
+ValueView::iterator &ValueView::iterator::operator++() {
+  ++index;
+  return *this;
+}
+
+ValueView::iterator ValueView::iterator::operator++(int) {
+  auto copy = *this;
+  ++index;
+  return copy;
+}
+
+ValueView::ValueView(const SnapshotView *snapshot, uint32_t index)
+    : snapshot(snapshot), index(index) {}
+
+void ValueView::ensureKind(Value::Kind expected) const {
+  auto kind = getKind();
+  if (kind != expected) {
+    throw TypeError(Value::toString(expected), Value::toString(kind),
+                    getPath(), getLocation());
+  }
+}
+
+uint32_t ValueView::getItemCount() const {
+  auto kind = getKind();
+  if (kind != Value::Kind::Array && kind != Value::Kind::Object) {
+    return 0;
+  }
+
+  uint32_t count;
+  snapshot->items(index, count);
+  return count;
+}
+
+Location ValueView::getLocation() const { return snapshot->location(index); }
+
+std::string ValueView::getPath() const { return snapshot->path(index); }
+
+std::string ValueView::getKey() const { return snapshot->key(index); }
+
+Value::Kind ValueView::getKind() const { return snapshot->kind(index); }
+
+bool ValueView::isBool() const { return getKind() == Value::Kind::Bool; }
+
+bool ValueView::isInt() const { return getKind() == Value::Kind::Int; }
+
+bool ValueView::isFloat() const { return getKind() == Value::Kind::Float; }
+
+bool ValueView::isString() const { return getKind() == Value::Kind::String; }
+
+bool ValueView::isNull() const { return getKind() == Value::Kind::Null; }
+
+bool ValueView::isArray() const { return getKind() == Value::Kind::Array; }
+
+bool ValueView::isObject() const { return getKind() == Value::Kind::Object; }
+
+bool ValueView::asBool() const {
+  ensureKind(Value::Kind::Bool);
+  return snapshot->data(index) != 0;
+}
+
+int64_t ValueView::asInt() const {
+  ensureKind(Value::Kind::Int);
+  return static_cast<int64_t>(snapshot->data(index));
+}
+
+double ValueView::asFloat() const {
+  ensureKind(Value::Kind::Float);
+
+  auto data = snapshot->data(index);
+  double value;
+  std::memcpy(&value, &data, sizeof(value));
+  return value;
+}
+
+std::string ValueView::asString() const {
+  ensureKind(Value::Kind::String);
+
+  auto data = snapshot->data(index);
+  if (data >= NO_STRING) {
+    fail("string index out of range");
+  }
+
+  return snapshot->string(static_cast<uint32_t>(data));
+}
+
+ValueView ValueView::asNull() const {
+  ensureKind(Value::Kind::Null);
+  return *this;
+}
+
+ValueView ValueView::asArray() const {
+  ensureKind(Value::Kind::Array);
+  return *this;
+}
+
+ValueView ValueView::asObject() const {
+  ensureKind(Value::Kind::Object);
+  return *this;
+}
+
+ValueView ValueView::item(uint32_t index) const {
+  ensureKind(Value::Kind::Array);
+
+  uint32_t count;
+  auto first = snapshot->items(this->index, count);
+  if (index >= count) {
+    throw OutOfRangeError(index, getPath(), getLocation());
+  }
+
+  return ValueView(snapshot, first + index);
+}
+
+bool ValueView::find(const char *key, size_t keyLength,
+                     uint32_t &found) const {
+  ensureKind(Value::Kind::Object);
+
+  uint32_t count;
+  auto low = snapshot->items(index, count);
+  auto high = low + count;
+
+  while (low < high) {
+    auto middle = low + (high - low) / 2;
+    auto result = snapshot->compareKey(middle, key, keyLength);
+
+    if (result == 0) {
+      found = middle;
+      return true;
+    }
+
+    if (result < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return false;
+}
+
+ValueView ValueView::item(const std::string &key) const {
+  uint32_t found;
+  if (!find(key.data(), key.length(), found)) {
+    throw MissingKeyError(key, getPath(), getLocation());
+  }
+
+  return ValueView(snapshot, found);
+}
+
+ValueView ValueView::item(const Key &key) const {
+  uint32_t found;
+  if (!find(key.data(), key.length(), found)) {
+    throw MissingKeyError(key.toString(), getPath(), getLocation());
+  }
+
+  return ValueView(snapshot, found);
+}
+
+ValueView ValueView::operator[](uint32_t index) const { return item(index); }
+
+ValueView ValueView::operator[](const Key &key) const { return item(key); }
+
+bool ValueView::contains(const std::string &key) const {
+  uint32_t found;
+  return find(key.data(), key.length(), found);
+}
+
+bool ValueView::contains(const Key &key) const {
+  uint32_t found;
+  return find(key.data(), key.length(), found);
+}
+
+std::vector<std::string> ValueView::keys() const {
+  ensureKind(Value::Kind::Object);
+
+  std::vector<std::string> keys;
+  keys.reserve(getItemCount());
+
+  for (auto item : *this) {
+    keys.push_back(item.getKey());
+  }
+
+  return keys;
+}
+
+ValueView::iterator ValueView::begin() const {
+  if (getItemCount() == 0) {
+    return iterator(snapshot, 0);
+  }
+
+  uint32_t count;
+  return iterator(snapshot, snapshot->items(index, count));
+}
+
+ValueView::iterator ValueView::end() const {
+  if (getItemCount() == 0) {
+    return iterator(snapshot, 0);
+  }
+
+  uint32_t count;
+  auto first = snapshot->items(index, count);
+  return iterator(snapshot, first + count);
+}
+
+Value ValueView::toValue() const { return BinaryReader(*snapshot).read(index); }
+
+MappedSnapshot::Mapping::Mapping(const std::string &fileName)
+    : data(nullptr), size(0), mapped(false) {
+#ifdef CPPCSON_MMAP
+  auto fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot open " + fileName);
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    auto error = errno;
+    close(fd);
+    throw std::system_error(error, std::generic_category(),
+                            "Cannot open " + fileName);
+  }
+
+  size = static_cast<size_t>(info.st_size);
+  if (size > 0) {
+    // Shared read-only pages are backed by the page cache, so all processes
+    // mapping the file use the same memory
+    auto address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+      auto error = errno;
+      close(fd);
+      throw std::system_error(error, std::generic_category(),
+                              "Cannot map " + fileName);
+    }
+
+    data = static_cast<const char *>(address);
+    mapped = true;
+  }
+
+  close(fd);
+#else
+  std::ifstream stream(fileName, std::ios::binary);
+  if (!stream) {
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot open " + fileName);
+  }
+
+  buffer.assign(std::istreambuf_iterator<char>(stream),
+                std::istreambuf_iterator<char>());
+  data = buffer.data();
+  size = buffer.size();
+#endif
+}
+
+MappedSnapshot::Mapping::~Mapping() {
+#ifdef CPPCSON_MMAP
+  if (mapped) {
+    munmap(const_cast<char *>(data), size);
+  }
+#endif
+}
+
+MappedSnapshot::MappedSnapshot(const std::string &fileName,
+                               bool verifyChecksum)
+    : mapping(fileName), snapshot(mapping.data, mapping.size, verifyChecksum) {}
+
+ValueView MappedSnapshot::root() const { return snapshot.root(); }
+
+void saveBinary(std::string &out, const Value &value,
+                const BinaryOptions &options) {
+  BinaryWriter(options).write(out, value);
+}
+
+void saveBinary(std::ostream &stream, const Value &value,
+                const BinaryOptions &options) {
+  std::string out;
+  saveBinary(out, value, options);
+  stream.write(out.data(), static_cast<std::streamsize>(out.length()));
+}
+
+Value loadBinary(const char *data, size_t size) {
+  SnapshotView snapshot(data, size, true);
+  return BinaryReader(snapshot).read(0);
+}
+
+Value loadBinary(std::istream &stream) {
+  const size_t CHUNK_SIZE = 64 * 1024;
+
+  std::string data(HEADER_SIZE, '\0');
+  stream.read(&data[0], HEADER_SIZE);
+  if (stream.gcount() != static_cast<std::streamsize>(HEADER_SIZE)) {
+    throw BinaryFormatError("Invalid binary snapshot: missing header");
+  }
+
+  // The payload is read in chunks, so a corrupt size cannot cause a huge
+  // allocation up front
+  auto remaining = loadU64(data.data() + 32);
+  while (remaining > 0) {
+    auto chunk = static_cast<size_t>(std::min<uint64_t>(remaining, CHUNK_SIZE));
+    auto offset = data.length();
+    data.resize(offset + chunk);
+
+    stream.read(&data[offset], static_cast<std::streamsize>(chunk));
+    if (stream.gcount() != static_cast<std::streamsize>(chunk)) {
+      throw BinaryFormatError("Invalid binary snapshot: unexpected end");
+    }
+
+    remaining -= chunk;
+  }
+
+  return loadBinary(data.data(), data.length());
+}
+
+} // namespace cppcson
@@ -0,0 +1,52 @@
+#include "internal.hpp"
+
+namespace cppcson {
+
+Decoder::~Decoder() = default;
+
+Binder::~Binder() = default;
+
+void Binder::mismatch(const Decoder &decoder, Value::Kind actual,
+                      const Location &location) const {
+  throw TypeError(Value::toString(expected()), Value::toString(actual),
+                  decoder.path(), location);
+}
+
+void Binder::bindNull(Decoder &decoder, const Location &location) {
+  mismatch(decoder, Value::Kind::Null, location);
+}
+
+void Binder::bindBool(Decoder &decoder, bool, const Location &location) {
+  mismatch(decoder, Value::Kind::Bool, location);
+}
+
+void Binder::bindInt(Decoder &decoder, int64_t, const Location &location) {
+  mismatch(decoder, Value::Kind::Int, location);
+}
+
+void Binder::bindFloat(Decoder &decoder, double, const Location &location) {
+  mismatch(decoder, Value::Kind::Float, location);
+}
+
+void Binder::bindString(Decoder &decoder, std::string &&,
+                        const Location &location) {
+  mismatch(decoder, Value::Kind::String, location);
+}
+
+void Binder::beginArray(Decoder &decoder, const Location &location) {
+  mismatch(decoder, Value::Kind::Array, location);
+}
+
+void Binder::bindItem(Decoder &, uint32_t) {}
+
+void Binder::endArray(Decoder &, const Location &) {}
+
+void Binder::beginObject(Decoder &decoder, const Location &location) {
+  mismatch(decoder, Value::Kind::Object, location);
+}
+
+void Binder::bindEntry(Decoder &, const std::string &) {}
+
+void Binder::endObject(Decoder &, const Location &) {}
+
+} // namespace cppcson
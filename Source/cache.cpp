@@ -0,0 +1,220 @@
+#include "internal.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CPPCSON_STAT
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <process.h>
+#endif
+
+namespace cppcson {
+
+// Returns false if the identity is unknown, which makes the cache always
+// check the contents.
+static bool fileIdentity(const std::string &fileName, uint64_t &size,
+                         int64_t &modified) {
+#ifdef CPPCSON_STAT
+  struct stat info;
+  if (stat(fileName.c_str(), &info) != 0) {
+    return false;
+  }
+
+  size = static_cast<uint64_t>(info.st_size);
+#if defined(__APPLE__)
+  modified = static_cast<int64_t>(info.st_mtimespec.tv_sec) * 1000000000 +
+             info.st_mtimespec.tv_nsec;
+#else
+  modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 +
+             info.st_mtim.tv_nsec;
+#endif
+  return true;
+#else
+  (void)fileName;
+  (void)size;
+  (void)modified;
+  return false;
+#endif
+}
+
+// Distinguishes temporary files of processes sharing a snapshot directory
+static uint64_t processId() {
+#ifdef CPPCSON_STAT
+  return static_cast<uint64_t>(getpid());
+#elif defined(_WIN32)
+  return static_cast<uint64_t>(_getpid());
+#else
+  return 0;
+#endif
+}
+
+// Modification times closer than this to the time they were recorded are not
+// trusted, as the file may change again without changing its time
+static const int64_t TIME_GRANULARITY = 2000000000;
+
+static int64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string internal::readFile(const std::string &fileName) {
+  std::ifstream stream(fileName, std::ios::binary);
+  if (!stream) {
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot open " + fileName);
+  }
+
+  std::ostringstream contents;
+  contents << stream.rdbuf();
+  return contents.str();
+}
+
+ParseCache::ParseCache(size_t capacity, const std::string &directory,
+                       const Options &options)
+    : capacity(capacity != 0 ? capacity : 1), directory(directory),
+      options(options) {}
+
+std::string ParseCache::snapshotName(uint64_t size, uint64_t hash) const {
+  char name[48];
+  std::snprintf(name, sizeof(name), "/%016" PRIx64 "-%" PRIu64 ".cppcsonb",
+                hash, size);
+  return directory + name;
+}
+
+std::shared_ptr<const Value> ParseCache::find(const std::string &fileName,
+                                              uint64_t size, int64_t modified,
+                                              bool checkHash, uint64_t hash) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto itr = index.find(fileName);
+  if (itr == index.end()) {
+    return nullptr;
+  }
+
+  auto &entry = *itr->second;
+  if (entry.size != size ||
+      (checkHash ? entry.hash != hash
+                 : entry.modified != modified ||
+                       modified > entry.recorded - TIME_GRANULARITY)) {
+    return nullptr;
+  }
+
+  if (checkHash) {
+    // Unchanged contents with a new time skip the hash next time
+    entry.modified = modified;
+    entry.recorded = now();
+  }
+  entries.splice(entries.begin(), entries, itr->second);
+  return entry.document;
+}
+
+void ParseCache::insert(Entry &&entry) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto itr = index.find(entry.fileName);
+  if (itr != index.end()) {
+    entries.erase(itr->second);
+    index.erase(itr);
+  }
+
+  entries.push_front(std::move(entry));
+  index.emplace(entries.front().fileName, entries.begin());
+
+  while (entries.size() > capacity) {
+    index.erase(entries.back().fileName);
+    entries.pop_back();
+  }
+}
+
+std::shared_ptr<const Value> ParseCache::parseContents(std::string &contents,
+                                                       uint64_t hash) {
+  auto size = static_cast<uint64_t>(contents.length());
+
+  if (!directory.empty()) {
+    std::ifstream stream(snapshotName(size, hash), std::ios::binary);
+    if (stream) {
+      try {
+        return std::make_shared<const Value>(loadBinary(stream));
+      } catch (const BinaryFormatError &) {
+        // Damaged or outdated snapshots are replaced below
+      }
+    }
+  }
+
+  internal::MemoryBuffer buffer(contents);
+  std::istream stream(&buffer);
+  auto document = std::make_shared<const Value>(parse(stream, options));
+
+  if (!directory.empty()) {
+    // Written under a temporary name and renamed, so concurrent loaders
+    // never read a partial snapshot
+    auto name = snapshotName(size, hash);
+    auto tempName = name + "." + std::to_string(processId()) + "." +
+                    std::to_string(std::hash<std::thread::id>()(
+                        std::this_thread::get_id())) +
+                    ".tmp";
+
+    std::ofstream stream(tempName, std::ios::binary);
+    saveBinary(stream, *document);
+    stream.close();
+
+    // Failed writes, e.g. on a full disk, must not replace a snapshot
+    if (!stream || std::rename(tempName.c_str(), name.c_str()) != 0) {
+      std::remove(tempName.c_str());
+    }
+  }
+
+  return document;
+}
+
+std::shared_ptr<const Value> ParseCache::load(const std::string &fileName) {
+  uint64_t size = 0;
+  int64_t modified = 0;
+  auto recorded = now();
+  auto known = fileIdentity(fileName, size, modified);
+
+  if (known) {
+    auto document = find(fileName, size, modified, false, 0);
+    if (document) {
+      return document;
+    }
+  }
+
+  auto contents = internal::readFile(fileName);
+  auto hash = internal::hashBytes(contents.data(), contents.length());
+  size = static_cast<uint64_t>(contents.length());
+  if (!known) {
+    modified = -1;
+  }
+
+  auto document = find(fileName, size, modified, true, hash);
+  if (document) {
+    return document;
+  }
+
+  document = parseContents(contents, hash);
+  insert({fileName, size, modified, recorded, hash, document});
+  return document;
+}
+
+void ParseCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  index.clear();
+  entries.clear();
+}
+
+size_t ParseCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  return entries.size();
+}
+
+} // namespace cppcson
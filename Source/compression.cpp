@@ -0,0 +1,185 @@
+#include "cppcson.hpp"
+#include <memory>
+
+#ifdef CPPCSON_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef CPPCSON_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace cppcson {
+
+static const size_t INPUT_CHUNK_SIZE = 64 * 1024;
+
+static size_t readChunk(std::istream &stream, std::vector<char> &chunk) {
+  if (!stream.good()) {
+    return 0;
+  }
+
+  stream.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+  return static_cast<size_t>(stream.gcount());
+}
+
+static Value parseSource(const ReadAheadBuffer::Source &source,
+                         const Options &options) {
+  ReadAheadBuffer buffer(
+      source, options.readAheadBuffers != 0 ? options.readAheadBuffers : 2,
+      options.readAheadBufferSize != 0 ? options.readAheadBufferSize
+                                       : ReadAheadBuffer::DEFAULT_BUFFER_SIZE);
+  std::istream stream(&buffer);
+  stream.exceptions(std::ios::badbit);
+
+  auto directOptions = options;
+  directOptions.readAheadBuffers = 0;
+
+  return parse(stream, directOptions);
+}
+
+#ifdef CPPCSON_WITH_ZLIB
+namespace {
+struct GzipState {
+  std::istream &stream;
+  std::vector<char> chunk;
+  z_stream zStream;
+  bool inputEnded;
+  bool streamEnded;
+
+  explicit GzipState(std::istream &stream)
+      : stream(stream), chunk(INPUT_CHUNK_SIZE), zStream(), inputEnded(false),
+        streamEnded(false) {
+    // 32 enables automatic detection of gzip and zlib headers
+    if (inflateInit2(&zStream, 15 + 32) != Z_OK) {
+      throw CompressionError("Could not initialize zlib");
+    }
+  }
+
+  GzipState(const GzipState &) = delete;
+
+  ~GzipState() { inflateEnd(&zStream); }
+
+  size_t read(char *buffer, size_t size) {
+    zStream.next_out = reinterpret_cast<Bytef *>(buffer);
+    zStream.avail_out = static_cast<uInt>(size);
+
+    while (zStream.avail_out != 0) {
+      if (zStream.avail_in == 0 && !inputEnded) {
+        auto length = readChunk(stream, chunk);
+        inputEnded = length == 0;
+        zStream.next_in = reinterpret_cast<Bytef *>(chunk.data());
+        zStream.avail_in = static_cast<uInt>(length);
+      }
+
+      if (streamEnded) {
+        if (zStream.avail_in == 0) {
+          break;
+        }
+
+        // Concatenated gzip members form one logical stream
+        if (inflateReset(&zStream) != Z_OK) {
+          throw CompressionError("Could not reset zlib");
+        }
+        streamEnded = false;
+      }
+
+      auto result = inflate(&zStream, Z_NO_FLUSH);
+      if (result == Z_STREAM_END) {
+        streamEnded = true;
+      } else if (result == Z_BUF_ERROR) {
+        // No progress possible although output space is left
+        throw CompressionError("Unexpected end of gzip data");
+      } else if (result != Z_OK) {
+        throw CompressionError("Invalid gzip data");
+      }
+    }
+
+    return size - zStream.avail_out;
+  }
+};
+} // namespace
+
+ReadAheadBuffer::Source gzipSource(std::istream &stream) {
+  std::shared_ptr<GzipState> state(new GzipState(stream));
+
+  return [state](char *buffer, size_t size) {
+    return state->read(buffer, size);
+  };
+}
+
+Value parseGzip(std::istream &stream, const Options &options) {
+  return parseSource(gzipSource(stream), options);
+}
+#endif
+
+#ifdef CPPCSON_WITH_ZSTD
+namespace {
+struct ZstdState {
+  std::istream &stream;
+  std::vector<char> chunk;
+  ZSTD_DCtx *context;
+  ZSTD_inBuffer input;
+  bool inputEnded;
+  bool frameEnded;
+
+  explicit ZstdState(std::istream &stream)
+      : stream(stream), chunk(INPUT_CHUNK_SIZE), context(ZSTD_createDCtx()),
+        input{chunk.data(), 0, 0}, inputEnded(false), frameEnded(true) {
+    if (context == nullptr) {
+      throw CompressionError("Could not initialize zstd");
+    }
+  }
+
+  ZstdState(const ZstdState &) = delete;
+
+  ~ZstdState() { ZSTD_freeDCtx(context); }
+
+  size_t read(char *buffer, size_t size) {
+    ZSTD_outBuffer output{buffer, size, 0};
+
+    while (output.pos != output.size) {
+      if (input.pos == input.size && !inputEnded) {
+        auto length = readChunk(stream, chunk);
+        inputEnded = length == 0;
+        input.size = length;
+        input.pos = 0;
+      }
+
+      if (input.pos == input.size && frameEnded) {
+        break;
+      }
+
+      auto oldOutputPos = output.pos;
+      auto result = ZSTD_decompressStream(context, &output, &input);
+      if (ZSTD_isError(result)) {
+        throw CompressionError(std::string("Invalid zstd data: ") +
+                               ZSTD_getErrorName(result));
+      }
+
+      frameEnded = result == 0;
+
+      if (!frameEnded && inputEnded && input.pos == input.size &&
+          output.pos == oldOutputPos) {
+        throw CompressionError("Unexpected end of zstd data");
+      }
+    }
+
+    return output.pos;
+  }
+};
+} // namespace
+
+ReadAheadBuffer::Source zstdSource(std::istream &stream) {
+  std::shared_ptr<ZstdState> state(new ZstdState(stream));
+
+  return [state](char *buffer, size_t size) {
+    return state->read(buffer, size);
+  };
+}
+
+Value parseZstd(std::istream &stream, const Options &options) {
+  return parseSource(zstdSource(stream), options);
+}
+#endif
+
+} // namespace cppcson
@@ -1,11 +1,17 @@
-#include "cppcson.hpp"
+#include "internal.hpp"
 #include <cmath>
+#include <cstring>
+#include <sstream>
 #include <string>
 
 namespace cppcson {
 
-static const std::vector<Value> EMPTY_VECTOR;
-static const std::map<std::string, Value> EMPTY_MAP;
+using SharedArray = internal::Shared<std::vector<Value>>;
+using SharedObject = internal::Shared<std::map<std::string, Value>>;
+
+// Items of all empty containers, which are never counted or modified
+static SharedArray EMPTY_ARRAY{std::vector<Value>()};
+static SharedObject EMPTY_OBJECT{std::map<std::string, Value>()};
 
 static bool isspace(int c) { return c >= 0 && std::isspace(c); }
 
@@ -48,6 +54,15 @@ bool Location::operator!=(const Location &other) const {
          endLine != other.endLine || endColumn != other.endColumn;
 }
 
+std::string Key::toString() const { return std::string(keyData, keyLength); }
+
+bool Key::operator==(const Key &other) const {
+  return keyLength == other.keyLength &&
+         std::memcmp(keyData, other.keyData, keyLength) == 0;
+}
+
+bool Key::operator!=(const Key &other) const { return !(*this == other); }
+
 std::ostream &operator<<(std::ostream &os, const Location &location) {
   return os << "Location(startLine: " << location.startLine
             << ", startColumn: " << location.startColumn
@@ -84,6 +99,31 @@ SyntaxError::SyntaxError(const std::string &message, const Location &location)
 NestingTooDeepError::NestingTooDeepError()
     : Error("Nesting of data is too deep", Location::unknown()) {}
 
+CancelledError::CancelledError(const Location &location)
+    : Error("Parsing was cancelled", location) {}
+
+LimitExceededError::LimitExceededError(const std::string &message,
+                                       const Location &location)
+    : Error(message, location) {}
+
+CompressionError::CompressionError(const std::string &message)
+    : Error(message, Location::unknown()) {}
+
+EmitterError::EmitterError(const std::string &message)
+    : Error(message, Location::unknown()) {}
+
+BinaryFormatError::BinaryFormatError(const std::string &message)
+    : Error(message, Location::unknown()) {}
+
+PatchError::PatchError(const std::string &message)
+    : Error(message, Location::unknown()) {}
+
+SchemaError::SchemaError(const std::string &message, const Location &location)
+    : Error(message, location) {}
+
+PathError::PathError(const std::string &message)
+    : Error(message, Location::unknown()) {}
+
 [[noreturn]] static void unreachable() {
   throw std::runtime_error("Unreachable code reached");
 }
@@ -143,79 +183,151 @@ const char *Value::toString(Value::Kind kind) {
   }
 }
 
-Value::Value(Kind kind, const Location &location, const std::string &path,
-             const std::string &strValue, const Value::NonStrValue &nonStrValue)
-    : kind(kind), location(location), path(path), strValue(strValue),
-      nonStrValue(nonStrValue) {}
+Value::Value(Kind kind, const Location &location, std::string &&path,
+             std::string &&strValue, const Value::NonStrValue &nonStrValue)
+    : kind(kind), location(location), path(std::move(path)),
+      strValue(std::move(strValue)), nonStrValue(nonStrValue), cache(nullptr),
+      hashValue(0) {}
 
-Value Value::fromBool(const Location &location, const std::string &path,
+Value Value::fromBool(const Location &location, std::string &&path,
                       bool value) {
   NonStrValue nonStrValue{false};
   nonStrValue.boolValue = value;
 
-  return Value(Kind::Bool, location, path, "", nonStrValue);
+  return Value(Kind::Bool, location, std::move(path), "", nonStrValue);
 }
 
-Value Value::fromInt(const Location &location, const std::string &path,
+Value Value::fromInt(const Location &location, std::string &&path,
                      int64_t value) {
   NonStrValue nonStrValue{false};
   nonStrValue.intValue = value;
 
-  return Value(Kind::Int, location, path, "", nonStrValue);
+  return Value(Kind::Int, location, std::move(path), "", nonStrValue);
 }
 
-Value Value::fromFloat(const Location &location, const std::string &path,
+Value Value::fromFloat(const Location &location, std::string &&path,
                        double value) {
   NonStrValue nonStrValue{false};
   nonStrValue.floatValue = value;
 
-  return Value(Kind::Float, location, path, "", nonStrValue);
+  return Value(Kind::Float, location, std::move(path), "", nonStrValue);
 }
 
-Value Value::fromString(const Location &location, const std::string &path,
-                        const std::string &value) {
-  return Value(Kind::String, location, path, value, NonStrValue());
+Value Value::fromString(const Location &location, std::string &&path,
+                        std::string &&value) {
+  return Value(Kind::String, location, std::move(path), std::move(value),
+               NonStrValue());
 }
 
-Value Value::fromNull(const Location &location, const std::string &path) {
-  return Value(Kind::Null, location, path, "", NonStrValue());
+Value Value::fromNull(const Location &location, std::string &&path) {
+  return Value(Kind::Null, location, std::move(path), "", NonStrValue());
 }
 
-Value Value::fromArray(const Location &location, const std::string &path,
-                       const std::vector<Value> *arrayValue) {
+Value Value::fromArray(const Location &location, std::string &&path,
+                       std::vector<Value> &&items) {
   NonStrValue nonStrValue{false};
-  nonStrValue.arrayValue = arrayValue;
+  nonStrValue.arrayValue =
+      items.empty() ? &EMPTY_ARRAY : new SharedArray(std::move(items));
 
-  return Value(Kind::Array, location, path, "", nonStrValue);
+  return Value(Kind::Array, location, std::move(path), "", nonStrValue);
 }
 
-Value Value::fromObject(const Location &location, const std::string &path,
-                        const std::map<std::string, Value> *objectValue) {
+Value Value::fromObject(const Location &location, std::string &&path,
+                        std::map<std::string, Value> &&entries) {
   NonStrValue nonStrValue{false};
-  nonStrValue.objectValue = objectValue;
+  nonStrValue.objectValue =
+      entries.empty() ? &EMPTY_OBJECT : new SharedObject(std::move(entries));
+
+  return Value(Kind::Object, location, std::move(path), "", nonStrValue);
+}
+
+template <typename Items>
+static void dropReference(internal::Shared<Items> *shared,
+                          const internal::Shared<Items> &empty) {
+  if (shared != &empty &&
+      shared->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete shared;
+  }
+}
+
+template <typename Items>
+static void addReference(internal::Shared<Items> *shared,
+                         const internal::Shared<Items> &empty) {
+  if (shared != &empty) {
+    shared->references.fetch_add(1, std::memory_order_relaxed);
+  }
+}
 
-  return Value(Kind::Object, location, path, "", nonStrValue);
+static std::vector<Value> cloneItems(const std::vector<Value> &items) {
+  std::vector<Value> result;
+  result.reserve(items.size());
+
+  for (auto &itemValue : items) {
+    result.push_back(itemValue.clone());
+  }
+
+  return result;
+}
+
+static std::map<std::string, Value>
+cloneItems(const std::map<std::string, Value> &entries) {
+  std::map<std::string, Value> result;
+
+  for (auto &entry : entries) {
+    result.emplace_hint(result.end(), entry.first, entry.second.clone());
+  }
+
+  return result;
+}
+
+// Returns items owned by this value alone, copying shared ones
+template <typename Items>
+static internal::Shared<Items> *
+makeUnique(internal::Shared<Items> *shared,
+           const internal::Shared<Items> &empty) {
+  if (shared == &empty) {
+    return new internal::Shared<Items>(Items());
+  }
+
+  if (shared->references.load(std::memory_order_acquire) == 1) {
+    return shared;
+  }
+
+  auto copy = new internal::Shared<Items>(cloneItems(shared->items));
+  dropReference(shared, empty);
+  return copy;
 }
 
 void Value::release() {
+  invalidateCache();
+
   switch (kind) {
-  case Kind::Array: {
-    if (nonStrValue.arrayValue != &EMPTY_VECTOR) {
-      delete nonStrValue.arrayValue;
-    }
+  case Kind::Array:
+    dropReference(nonStrValue.arrayValue, EMPTY_ARRAY);
     break;
-  }
-  case Kind::Object: {
-    if (nonStrValue.objectValue != &EMPTY_MAP) {
-      delete nonStrValue.objectValue;
-    }
+  case Kind::Object:
+    dropReference(nonStrValue.objectValue, EMPTY_OBJECT);
     break;
-  }
   default:
     break;
   }
 }
 
+std::vector<Value> &Value::modifiableItems() {
+  nonStrValue.arrayValue = makeUnique(nonStrValue.arrayValue, EMPTY_ARRAY);
+  return nonStrValue.arrayValue->items;
+}
+
+std::map<std::string, Value> &Value::modifiableEntries() {
+  nonStrValue.objectValue = makeUnique(nonStrValue.objectValue, EMPTY_OBJECT);
+  return nonStrValue.objectValue->items;
+}
+
+void Value::invalidateCache() {
+  delete cache.exchange(nullptr);
+  hashValue = 0;
+}
+
 void Value::ensureKind(Value::Kind expected) const {
   if (kind != expected) {
     throw TypeError(toString(expected), toString(kind), getPath(), location);
@@ -235,49 +347,44 @@ Value Value::newFloat(double value) {
 }
 
 Value Value::newString(const std::string &value) {
-  return Value::fromString(Location::unknown(), "", value);
+  return Value::fromString(Location::unknown(), "", std::string(value));
+}
+
+Value Value::newString(std::string &&value) {
+  return Value::fromString(Location::unknown(), "", std::move(value));
 }
 
 Value Value::newNull() { return Value::fromNull(Location::unknown(), ""); }
 
 Value Value::newArray() {
-  return Value::fromArray(Location::unknown(), "", &EMPTY_VECTOR);
+  return Value::fromArray(Location::unknown(), "", std::vector<Value>());
 }
 
 Value Value::newArray(std::vector<Value> &&list) {
-  const std::vector<Value> *arrayValue = &EMPTY_VECTOR;
-
-  if (!list.empty()) {
-    arrayValue = new std::vector<Value>(std::move(list));
-  }
-
-  return Value::fromArray(Location::unknown(), "", arrayValue);
+  return Value::fromArray(Location::unknown(), "", std::move(list));
 }
 
 Value Value::newObject() {
-  return Value::fromObject(Location::unknown(), "", &EMPTY_MAP);
+  return Value::fromObject(Location::unknown(), "",
+                           std::map<std::string, Value>());
 }
 
 Value Value::newObject(std::map<std::string, Value> &&map) {
-  const std::map<std::string, Value> *objectValue = &EMPTY_MAP;
-
-  if (!map.empty()) {
-    objectValue = new std::map<std::string, Value>(std::move(map));
-  }
-
-  return Value::fromObject(Location::unknown(), "", objectValue);
+  return Value::fromObject(Location::unknown(), "", std::move(map));
 }
 
 Value::Value(Value &&other) noexcept
-    : kind(other.kind), location(other.location), path(other.path),
-      strValue(other.strValue), nonStrValue(other.nonStrValue) {
+    : kind(other.kind), location(other.location), path(std::move(other.path)),
+      strValue(std::move(other.strValue)), nonStrValue(other.nonStrValue),
+      cache(other.cache.exchange(nullptr)),
+      hashValue(other.hashValue.exchange(0)) {
   switch (kind) {
   case Kind::Array: {
-    other.nonStrValue.arrayValue = &EMPTY_VECTOR;
+    other.nonStrValue.arrayValue = &EMPTY_ARRAY;
     break;
   }
   case Kind::Object: {
-    other.nonStrValue.objectValue = &EMPTY_MAP;
+    other.nonStrValue.objectValue = &EMPTY_OBJECT;
     break;
   }
   default:
@@ -287,12 +394,33 @@ Value::Value(Value &&other) noexcept
 
 Value::~Value() { release(); }
 
+Value Value::clone() const {
+  Value copy(kind, location, std::string(path), std::string(strValue),
+             nonStrValue);
+
+  switch (kind) {
+  case Kind::Array:
+    addReference(nonStrValue.arrayValue, EMPTY_ARRAY);
+    break;
+  case Kind::Object:
+    addReference(nonStrValue.objectValue, EMPTY_OBJECT);
+    break;
+  default:
+    break;
+  }
+
+  // Equal contents have the same hash
+  copy.hashValue.store(hashValue.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+  return copy;
+}
+
 uint32_t Value::getItemCount() const {
   switch (kind) {
   case Kind::Array:
-    return static_cast<uint32_t>(nonStrValue.arrayValue->size());
+    return static_cast<uint32_t>(nonStrValue.arrayValue->items.size());
   case Kind::Object:
-    return static_cast<uint32_t>(nonStrValue.objectValue->size());
+    return static_cast<uint32_t>(nonStrValue.objectValue->items.size());
   default:
     return 0;
   }
@@ -363,69 +491,112 @@ const Value &Value::asObject() const {
 const Value &Value::item(uint32_t index) const {
   ensureKind(Kind::Array);
 
-  if (index >= nonStrValue.arrayValue->size()) {
+  if (index >= nonStrValue.arrayValue->items.size()) {
     throw OutOfRangeError(index, getPath(), location);
   }
 
-  return nonStrValue.arrayValue->at(index);
+  return nonStrValue.arrayValue->items.at(index);
 }
 
 const Value &Value::item(const std::string &key) const {
   ensureKind(Kind::Object);
 
-  auto itr = nonStrValue.objectValue->find(key);
-  if (itr == nonStrValue.objectValue->end()) {
+  auto itr = nonStrValue.objectValue->items.find(key);
+  if (itr == nonStrValue.objectValue->items.end()) {
     throw MissingKeyError(key, getPath(), location);
   }
 
   return itr->second;
 }
 
+// Ordered maps only search by std::string in C++11, so keys are copied into
+// a buffer keeping its capacity
+static const std::string &keyBuffer(const Key &key) {
+  static thread_local std::string buffer;
+
+  buffer.assign(key.data(), key.length());
+  return buffer;
+}
+
+const Value &Value::item(const Key &key) const {
+  return item(keyBuffer(key));
+}
+
+const Value &Value::operator[](uint32_t index) const { return item(index); }
+
+const Value &Value::operator[](const Key &key) const { return item(key); }
+
+const Value &Value::at(const Path &path) const {
+  if (path.segments.empty()) {
+    return *this;
+  }
+
+  const void *items = nullptr;
+  if (path.caching && kind == Kind::Array) {
+    items = nonStrValue.arrayValue;
+  } else if (path.caching && kind == Kind::Object) {
+    items = nonStrValue.objectValue;
+  }
+
+  if (items != nullptr) {
+    auto value = path.cached(items);
+    if (value != nullptr) {
+      return *value;
+    }
+  }
+
+  auto value = this;
+  for (auto &segment : path.segments) {
+    value = segment.isIndex ? &value->item(segment.index)
+                            : &value->item(segment.key);
+  }
+
+  if (items != nullptr) {
+    path.cache(*this, *value);
+  }
+
+  return *value;
+}
+
 bool Value::contains(const std::string &key) const {
   ensureKind(Kind::Object);
 
-  return nonStrValue.objectValue->find(key) != nonStrValue.objectValue->end();
+  return nonStrValue.objectValue->items.count(key) != 0;
+}
+
+bool Value::contains(const Key &key) const {
+  return contains(keyBuffer(key));
 }
 
 void Value::add(Value &&value) {
   ensureKind(Kind::Array);
+  invalidateCache();
 
-  if (nonStrValue.arrayValue == &EMPTY_VECTOR) {
-    nonStrValue.arrayValue = new std::vector<Value>();
-  }
-
-  const_cast<std::vector<Value> *>(nonStrValue.arrayValue)
-      ->push_back(std::move(value));
+  modifiableItems().push_back(std::move(value));
 }
 
 void Value::add(uint32_t index, Value &&value) {
   ensureKind(Kind::Array);
+  invalidateCache();
 
-  if (nonStrValue.arrayValue == &EMPTY_VECTOR) {
-    nonStrValue.arrayValue = new std::vector<Value>();
-  }
-
-  const_cast<std::vector<Value> *>(nonStrValue.arrayValue)
-      ->insert(nonStrValue.arrayValue->begin() + index, std::move(value));
+  auto &items = modifiableItems();
+  items.insert(items.begin() + index, std::move(value));
 }
 
 void Value::add(const std::string &key, Value &&value) {
   ensureKind(Kind::Object);
+  invalidateCache();
 
-  if (nonStrValue.objectValue == &EMPTY_MAP) {
-    nonStrValue.objectValue = new std::map<std::string, Value>();
-  }
-
-  const_cast<std::map<std::string, Value> *>(nonStrValue.objectValue)
-      ->emplace(key, std::move(value));
+  modifiableEntries().emplace(key, std::move(value));
 }
 
 bool Value::remove(uint32_t index) {
   ensureKind(Kind::Array);
+  invalidateCache();
 
-  if (index < nonStrValue.arrayValue->size()) {
-    const_cast<std::vector<Value> *>(nonStrValue.arrayValue)
-        ->erase(nonStrValue.arrayValue->begin() + index);
+  if (index < nonStrValue.arrayValue->items.size()) {
+    auto &items = modifiableItems();
+    items.erase(items.begin() + index);
     return true;
   }
 
@@ -434,11 +605,10 @@ bool Value::remove(uint32_t index) {
 
 bool Value::remove(const std::string &key) {
   ensureKind(Kind::Object);
+  invalidateCache();
 
-  auto itr = nonStrValue.objectValue->find(key);
-  if (itr != nonStrValue.objectValue->end()) {
-    const_cast<std::map<std::string, Value> *>(nonStrValue.objectValue)
-        ->erase(itr);
+  if (nonStrValue.objectValue->items.count(key) != 0) {
+    modifiableEntries().erase(key);
     return true;
   }
 
@@ -446,20 +616,18 @@ bool Value::remove(const std::string &key) {
 }
 
 void Value::clear() {
+  invalidateCache();
+
+  // Shared items are left to the other values instead of being copied
   switch (kind) {
-  case Kind::Array: {
-    if (nonStrValue.arrayValue != &EMPTY_VECTOR) {
-      const_cast<std::vector<Value> *>(nonStrValue.arrayValue)->clear();
-    }
+  case Kind::Array:
+    dropReference(nonStrValue.arrayValue, EMPTY_ARRAY);
+    nonStrValue.arrayValue = &EMPTY_ARRAY;
     break;
-  }
-  case Kind::Object: {
-    if (nonStrValue.objectValue != &EMPTY_MAP) {
-      const_cast<std::map<std::string, Value> *>(nonStrValue.objectValue)
-          ->clear();
-    }
+  case Kind::Object:
+    dropReference(nonStrValue.objectValue, EMPTY_OBJECT);
+    nonStrValue.objectValue = &EMPTY_OBJECT;
     break;
-  }
   default:
     break;
   }
@@ -468,19 +636,19 @@ void Value::clear() {
 Keys Value::keys() const {
   ensureKind(Kind::Object);
 
-  return Keys(*nonStrValue.objectValue);
+  return Keys(nonStrValue.objectValue->items);
 }
 
 Value::iterator Value::begin() const {
   ensureKind(Kind::Array);
 
-  return nonStrValue.arrayValue->begin();
+  return nonStrValue.arrayValue->items.begin();
 }
 
 Value::iterator Value::end() const {
   ensureKind(Kind::Array);
 
-  return nonStrValue.arrayValue->end();
+  return nonStrValue.arrayValue->items.end();
 }
 
 Value &Value::operator=(Value &&other) noexcept {
@@ -488,17 +656,20 @@ Value &Value::operator=(Value &&other) noexcept {
 
   kind = other.kind;
   location = other.location;
-  path = other.path;
-  strValue = other.strValue;
+  path = std::move(other.path);
+  strValue = std::move(other.strValue);
   nonStrValue = other.nonStrValue;
+  // The cache refers to the containers, which are moved along
+  cache = other.cache.exchange(nullptr);
+  hashValue = other.hashValue.exchange(0);
 
   switch (kind) {
   case Kind::Array: {
-    other.nonStrValue.arrayValue = &EMPTY_VECTOR;
+    other.nonStrValue.arrayValue = &EMPTY_ARRAY;
     break;
   }
   case Kind::Object: {
-    other.nonStrValue.objectValue = &EMPTY_MAP;
+    other.nonStrValue.objectValue = &EMPTY_OBJECT;
     break;
   }
   default:
@@ -508,6 +679,16 @@ Value &Value::operator=(Value &&other) noexcept {
   return *this;
 }
 
+// Compares hashes only if both are known already, as computing them would
+// traverse both trees once more
+static bool knownUnequal(const std::atomic<uint64_t> &hash,
+                         const std::atomic<uint64_t> &otherHash) {
+  auto value = hash.load(std::memory_order_relaxed);
+  auto otherValue = otherHash.load(std::memory_order_relaxed);
+
+  return value != 0 && otherValue != 0 && value != otherValue;
+}
+
 bool Value::operator==(const Value &other) const {
   if (kind != other.kind) {
     return false;
@@ -525,17 +706,19 @@ bool Value::operator==(const Value &other) const {
   case Kind::Null:
     return true;
   case Kind::Array:
-    return nonStrValue.arrayValue->size() ==
-               other.nonStrValue.arrayValue->size() &&
-           std::equal(nonStrValue.arrayValue->begin(),
-                      nonStrValue.arrayValue->end(),
-                      other.nonStrValue.arrayValue->begin());
+    return nonStrValue.arrayValue->items.size() ==
+               other.nonStrValue.arrayValue->items.size() &&
+           !knownUnequal(hashValue, other.hashValue) &&
+           std::equal(nonStrValue.arrayValue->items.begin(),
+                      nonStrValue.arrayValue->items.end(),
+                      other.nonStrValue.arrayValue->items.begin());
   case Kind::Object:
-    return nonStrValue.objectValue->size() ==
-               other.nonStrValue.objectValue->size() &&
-           std::equal(nonStrValue.objectValue->begin(),
-                      nonStrValue.objectValue->end(),
-                      other.nonStrValue.objectValue->begin());
+    return nonStrValue.objectValue->items.size() ==
+               other.nonStrValue.objectValue->items.size() &&
+           !knownUnequal(hashValue, other.hashValue) &&
+           std::equal(nonStrValue.objectValue->items.begin(),
+                      nonStrValue.objectValue->items.end(),
+                      other.nonStrValue.objectValue->items.begin());
   default:
     unreachable();
   }
@@ -543,14 +726,145 @@ bool Value::operator==(const Value &other) const {
 
 bool Value::operator!=(const Value &other) const { return !(*this == other); }
 
+template <typename T> static int compareScalars(const T &a, const T &b) {
+  return a < b ? -1 : (b < a ? 1 : 0);
+}
+
+// NaNs are ordered after all other floats and equivalent to each other
+static int compareFloats(double a, double b) {
+  if (std::isnan(a) || std::isnan(b)) {
+    return compareScalars(std::isnan(a), std::isnan(b));
+  }
+
+  return compareScalars(a, b);
+}
+
+int Value::compare(const Value &other) const {
+  if (kind != other.kind) {
+    return compareScalars(kind, other.kind);
+  }
+
+  switch (kind) {
+  case Kind::Bool:
+    return compareScalars(nonStrValue.boolValue, other.nonStrValue.boolValue);
+  case Kind::Int:
+    return compareScalars(nonStrValue.intValue, other.nonStrValue.intValue);
+  case Kind::Float:
+    return compareFloats(nonStrValue.floatValue, other.nonStrValue.floatValue);
+  case Kind::String: {
+    auto result = strValue.compare(other.strValue);
+    return compareScalars(result, 0);
+  }
+  case Kind::Null:
+    return 0;
+  case Kind::Array: {
+    auto &items = nonStrValue.arrayValue->items;
+    auto &otherItems = other.nonStrValue.arrayValue->items;
+
+    for (size_t i = 0; i < items.size() && i < otherItems.size(); ++i) {
+      auto result = items[i].compare(otherItems[i]);
+      if (result != 0) {
+        return result;
+      }
+    }
+
+    return compareScalars(items.size(), otherItems.size());
+  }
+  case Kind::Object: {
+    auto itr = nonStrValue.objectValue->items.begin();
+    auto end = nonStrValue.objectValue->items.end();
+    auto otherItr = other.nonStrValue.objectValue->items.begin();
+    auto otherEnd = other.nonStrValue.objectValue->items.end();
+
+    for (; itr != end && otherItr != otherEnd; ++itr, ++otherItr) {
+      auto result = compareScalars(itr->first.compare(otherItr->first), 0);
+      if (result == 0) {
+        result = itr->second.compare(otherItr->second);
+      }
+      if (result != 0) {
+        return result;
+      }
+    }
+
+    return compareScalars(itr != end, otherItr != otherEnd);
+  }
+  default:
+    unreachable();
+  }
+}
+
+bool Value::operator<(const Value &other) const { return compare(other) < 0; }
+
+static uint64_t mixHash(uint64_t hash, uint64_t value) {
+  return internal::mixBits(hash ^ internal::mixBits(value));
+}
+
+uint64_t Value::hash() const {
+  uint64_t result = mixHash(0xcbf29ce484222325, static_cast<uint64_t>(kind));
+
+  switch (kind) {
+  case Kind::Bool:
+    return mixHash(result, nonStrValue.boolValue);
+  case Kind::Int:
+    return mixHash(result, static_cast<uint64_t>(nonStrValue.intValue));
+  case Kind::Float: {
+    // -0.0 equals 0.0 and must hash alike
+    auto floatValue = nonStrValue.floatValue;
+    if (floatValue == 0) {
+      floatValue = 0;
+    }
+    uint64_t bits;
+    std::memcpy(&bits, &floatValue, sizeof(bits));
+    return mixHash(result, bits);
+  }
+  case Kind::String:
+    return mixHash(result, internal::hashBytes(strValue.data(),
+                                               strValue.length()));
+  case Kind::Null:
+    return result;
+  default:
+    break;
+  }
+
+  auto cached = hashValue.load(std::memory_order_relaxed);
+  if (cached != 0) {
+    return cached;
+  }
+
+  if (kind == Kind::Array) {
+    for (auto &itemValue : nonStrValue.arrayValue->items) {
+      result = mixHash(result, itemValue.hash());
+    }
+  } else {
+    for (auto &entry : nonStrValue.objectValue->items) {
+      result = mixHash(result, internal::hashBytes(entry.first.data(),
+                                                   entry.first.length()));
+      result = mixHash(result, entry.second.hash());
+    }
+  }
+
+  // 0 marks a missing hash
+  if (result == 0) {
+    result = 1;
+  }
+  hashValue.store(result, std::memory_order_relaxed);
+  return result;
+}
+
 std::ostream &operator<<(std::ostream &os, const Value &value) {
   switch (value.kind) {
   case Value::Kind::Bool:
     return os << (value.nonStrValue.boolValue ? "true" : "false");
-  case Value::Kind::Int:
-    return os << std::to_string(value.nonStrValue.intValue);
-  case Value::Kind::Float:
-    return os << std::to_string(value.nonStrValue.floatValue);
+  case Value::Kind::Int: {
+    std::string text;
+    internal::appendInt(text, value.nonStrValue.intValue);
+    return os << text;
+  }
+  case Value::Kind::Float: {
+    std::string text;
+    internal::appendFloat(text, value.nonStrValue.floatValue);
+    return os << text;
+  }
   case Value::Kind::String:
     return os << escape(value.strValue);
   case Value::Kind::Null:
@@ -559,7 +873,7 @@ std::ostream &operator<<(std::ostream &os, const Value &value) {
     os << "[";
 
     auto first = true;
-    for (auto &itemValue : *value.nonStrValue.arrayValue) {
+    for (auto &itemValue : value.nonStrValue.arrayValue->items) {
       if (first) {
         first = false;
       } else {
@@ -575,7 +889,7 @@ std::ostream &operator<<(std::ostream &os, const Value &value) {
     os << "{";
 
     auto first = true;
-    for (auto &entry : *value.nonStrValue.objectValue) {
+    for (auto &entry : value.nonStrValue.objectValue->items) {
       if (first) {
         first = false;
       } else {
@@ -664,8 +978,8 @@ struct Token {
       : kind(TokenKind::Int), location(location), intValue(value) {}
 
   explicit Token(TokenKind kind, const Location &location,
-                 const std::string &value)
-      : kind(kind), location(location), strValue(value) {}
+                 std::string &&value)
+      : kind(kind), location(location), strValue(std::move(value)) {}
 
   static Token fromFloat(const Location &location, double value) {
     Token token;
@@ -690,8 +1004,174 @@ static std::string toString(const Token &token) {
   }
 }
 
-class Parser {
+[[noreturn]] static void invalidPath(const std::string &path) {
+  throw PathError("Invalid path " + path);
+}
+
+static uint32_t parseIndex(const std::string &path, size_t start, size_t end) {
+  if (end == std::string::npos || end == start) {
+    invalidPath(path);
+  }
+
+  uint64_t index = 0;
+  for (auto pos = start; pos < end; ++pos) {
+    if (path[pos] < '0' || path[pos] > '9') {
+      invalidPath(path);
+    }
+
+    index = index * 10 + static_cast<uint64_t>(path[pos] - '0');
+    if (index > 0xFFFFFFFF) {
+      invalidPath(path);
+    }
+  }
+
+  return static_cast<uint32_t>(index);
+}
+
+static std::string parseQuotedKey(const std::string &path, size_t &pos) {
+  auto end = pos + 1;
+  while (end < path.length() && path[end] != '"') {
+    end += path[end] == '\\' ? 2 : 1;
+  }
+  if (end >= path.length()) {
+    invalidPath(path);
+  }
+
+  // Quoted keys are written as strings, so the parser reads them back
+  std::istringstream stream(path.substr(pos, end + 1 - pos));
+  pos = end + 1;
+  try {
+    return parse(stream).asString();
+  } catch (const Error &) {
+    invalidPath(path);
+  }
+}
+
+Path::Path(const std::string &text, bool caching)
+    : text(text), caching(caching), sequence(0), cachedItems(nullptr),
+      cachedArray(false), cachedValue(nullptr) {
+  if (text.empty() || text[0] != '.') {
+    invalidPath(text);
+  }
+
+  size_t pos = 1;
+
+  while (pos < text.length()) {
+    Segment segment{pos, false, 0, ""};
+
+    if (text[pos] == '[') {
+      auto end = text.find(']', pos);
+      segment.isIndex = true;
+      segment.index = parseIndex(text, pos + 1, end);
+      segments.push_back(std::move(segment));
+      pos = end + 1;
+      continue;
+    }
+
+    // Keys follow the root directly and other segments after a dot
+    if (!segments.empty()) {
+      if (text[pos] != '.') {
+        invalidPath(text);
+      }
+      ++pos;
+    }
+
+    if (pos < text.length() && text[pos] == '"') {
+      segment.key = parseQuotedKey(text, pos);
+    } else {
+      auto end = std::min(text.find_first_of(".[", pos), text.length());
+      segment.key = text.substr(pos, end - pos);
+      pos = end;
+    }
+
+    segments.push_back(std::move(segment));
+  }
+}
+
+Path::Path(const Path &other)
+    : text(other.text), segments(other.segments), caching(other.caching),
+      sequence(0), cachedItems(nullptr), cachedArray(false),
+      cachedValue(nullptr) {}
+
+Path::~Path() { release(cachedItems.load(), cachedArray.load()); }
+
+const std::string &Path::toString() const { return text; }
+
+void Path::release(const void *items, bool array) {
+  if (items == nullptr) {
+    return;
+  }
+
+  if (array) {
+    dropReference(static_cast<SharedArray *>(const_cast<void *>(items)),
+                  EMPTY_ARRAY);
+  } else {
+    dropReference(static_cast<SharedObject *>(const_cast<void *>(items)),
+                  EMPTY_OBJECT);
+  }
+}
+
+const Value *Path::cached(const void *items) const {
+  auto before = sequence.load();
+  if ((before & 1u) != 0 || cachedItems.load() != items) {
+    return nullptr;
+  }
+
+  auto value = cachedValue.load();
+  return sequence.load() == before ? value : nullptr;
+}
+
+void Path::cache(const Value &root, const Value &value) const {
+  // Threads racing to fill the cache leave it to the first one
+  auto current = sequence.load();
+  if ((current & 1u) != 0 ||
+      !sequence.compare_exchange_strong(current, current + 1)) {
+    return;
+  }
+
+  auto array = root.kind == Value::Kind::Array;
+  const void *items;
+  if (array) {
+    addReference(root.nonStrValue.arrayValue, EMPTY_ARRAY);
+    items = root.nonStrValue.arrayValue;
+  } else {
+    addReference(root.nonStrValue.objectValue, EMPTY_OBJECT);
+    items = root.nonStrValue.objectValue;
+  }
+
+  auto previousItems = cachedItems.exchange(items);
+  auto previousArray = cachedArray.exchange(array);
+  cachedValue.store(&value);
+  sequence.store(current + 2);
+
+  // Readers only hit the previous items through a root still referencing
+  // them, so they stay alive for those
+  release(previousItems, previousArray);
+}
+
+// Accepts any value, so that values not decoded by a binder are skipped
+class SkippingBinder : public Binder {
+public:
+  Value::Kind expected() const override { return Value::Kind::Null; }
+
+  void bindNull(Decoder &, const Location &) override {}
+
+  void bindBool(Decoder &, bool, const Location &) override {}
+
+  void bindInt(Decoder &, int64_t, const Location &) override {}
+
+  void bindFloat(Decoder &, double, const Location &) override {}
+
+  void bindString(Decoder &, std::string &&, const Location &) override {}
+
+  void beginArray(Decoder &, const Location &) override {}
+
+  void beginObject(Decoder &, const Location &) override {}
+};
+
+class Parser : public Decoder {
 private:
+  ParserContext &context;
   std::istream &stream;
   const Options &options;
   uint32_t nextLine;
@@ -700,6 +1180,18 @@ private:
   bool hasLookahead;
   Token lookaheadToken;
   uint32_t depth;
+  uint64_t consumedBytes;
+  uint64_t nextCheckpoint;
+  uint64_t nextProgress;
+  uint64_t nodeCount;
+  // State of decode(): path of the current value, whether the current item
+  // or entry was not decoded yet and the location of the last decoded one
+  std::string decodePath;
+  bool pendingValue;
+  Location valueLocation;
+
+  // Polling interval of the cancellation flag in bytes
+  static const uint64_t CANCEL_CHECK_INTERVAL = 4096;
 
   struct DepthHandler {
   private:
@@ -717,6 +1209,53 @@ private:
     ~DepthHandler() { --ref; }
   };
 
+  void updateCheckpoint() {
+    nextCheckpoint = consumedBytes + CANCEL_CHECK_INTERVAL;
+
+    if (options.progress && nextProgress < nextCheckpoint) {
+      nextCheckpoint = nextProgress;
+    }
+    if (options.maxBytes != 0 && options.maxBytes + 1 < nextCheckpoint) {
+      nextCheckpoint = options.maxBytes + 1;
+    }
+  }
+
+  void checkpoint() {
+    Location location(nextLine, nextColumn);
+
+    if (options.maxBytes != 0 && consumedBytes > options.maxBytes) {
+      throw LimitExceededError("Data exceeds the maximum number of bytes",
+                               location);
+    }
+
+    if (options.cancelled != nullptr && options.cancelled->load()) {
+      throw CancelledError(location);
+    }
+
+    if (options.progress && consumedBytes >= nextProgress) {
+      options.progress(consumedBytes);
+      nextProgress = consumedBytes + options.progressInterval;
+    }
+
+    updateCheckpoint();
+  }
+
+  void checkStringLength(const std::string &text,
+                         const Location &startLocation) {
+    if (options.maxStringLength != 0 &&
+        text.length() > options.maxStringLength) {
+      throw LimitExceededError("String exceeds the maximum length",
+                               startLocation);
+    }
+  }
+
+  void checkItemCount(size_t count, const Location &location) {
+    if (options.maxItems != 0 && count > options.maxItems) {
+      throw LimitExceededError("Container exceeds the maximum number of items",
+                               location);
+    }
+  }
+
   char nextChar(uint32_t &line, uint32_t &column) {
     auto c = stream.get();
     line = nextLine;
@@ -726,6 +1265,10 @@ private:
       return 0;
     }
 
+    if (++consumedBytes >= nextCheckpoint) {
+      checkpoint();
+    }
+
     if (c == '\n') {
       ++nextLine;
       nextColumn = 1;
@@ -759,7 +1302,8 @@ private:
     return utf16CodePoint >= 0xDC00 && utf16CodePoint <= 0xDFFF;
   }
 
-  static std::string utf16ToUTF8(long utf16CodePoint1, long utf16CodePoint2) {
+  static bool appendUTF8(std::string &text, long utf16CodePoint1,
+                         long utf16CodePoint2) {
     uint32_t unicode;
 
     if (utf16CodePoint2 == 0) {
@@ -771,32 +1315,29 @@ private:
     }
 
     if (unicode < 0x80) {
-      return std::string(1, static_cast<char>(unicode));
-    }
-    if (unicode < 0x800) {
-      return std::string(1, static_cast<char>(0xC0u | (unicode >> 6u))) +
-             std::string(1, static_cast<char>(0x80u | (unicode & 0x3Fu)));
-    }
-    if (unicode < 0x10000) {
-      return std::string(1, static_cast<char>(0xE0u | (unicode >> 12u))) +
-             std::string(1,
-                         static_cast<char>(0x80u | ((unicode >> 6u) & 0x3Fu))) +
-             std::string(1, static_cast<char>(0x80u | (unicode & 0x3Fu)));
-    }
-    if (unicode < 0x10FFFF) {
-      return std::string(1, static_cast<char>(0xF0u | (unicode >> 18u))) +
-             std::string(
-                 1, static_cast<char>(0x80u | ((unicode >> 12u) & 0x3Fu))) +
-             std::string(1,
-                         static_cast<char>(0x80u | ((unicode >> 6u) & 0x3Fu))) +
-             std::string(1, static_cast<char>(0x80u | (unicode & 0x3Fu)));
+      text += static_cast<char>(unicode);
+    } else if (unicode < 0x800) {
+      text += static_cast<char>(0xC0u | (unicode >> 6u));
+      text += static_cast<char>(0x80u | (unicode & 0x3Fu));
+    } else if (unicode < 0x10000) {
+      text += static_cast<char>(0xE0u | (unicode >> 12u));
+      text += static_cast<char>(0x80u | ((unicode >> 6u) & 0x3Fu));
+      text += static_cast<char>(0x80u | (unicode & 0x3Fu));
+    } else if (unicode < 0x10FFFF) {
+      text += static_cast<char>(0xF0u | (unicode >> 18u));
+      text += static_cast<char>(0x80u | ((unicode >> 12u) & 0x3Fu));
+      text += static_cast<char>(0x80u | ((unicode >> 6u) & 0x3Fu));
+      text += static_cast<char>(0x80u | (unicode & 0x3Fu));
+    } else {
+      return false;
     }
 
-    return "";
+    return true;
   }
 
   Token nextNumber(const Location &startLocation, char startChar) {
-    std::string text = std::string(1, startChar);
+    auto &text = context.text;
+    text.assign(1, startChar);
     auto endLine = startLocation.getStartLine();
     auto endColumn = startLocation.getStartColumn();
     auto foundE = false;
@@ -828,7 +1369,7 @@ private:
 
     auto isFloat = foundDot || (base == 10 && foundE);
     if (!isFloat && base != 10) {
-      text = text.erase(startIndex, 2);
+      text.erase(startIndex, 2);
     }
 
     char *endPtr;
@@ -854,7 +1395,8 @@ private:
   }
 
   Token nextString(const Location &startLocation, char startChar) {
-    std::string text;
+    auto &text = context.text;
+    text.clear();
     auto endLine = startLocation.getStartLine();
     auto endColumn = startLocation.getStartColumn();
     auto isMultiline = false;
@@ -949,7 +1491,7 @@ private:
           break;
         }
         case 'u': {
-          std::string escape;
+          char escape[5] = {};
 
           for (auto i = 0; i < 4; ++i) {
             c = nextChar(line, column);
@@ -960,26 +1502,26 @@ private:
                   Location(escapeLine, escapeColumn, line, column));
             }
 
-            escape += c;
+            escape[i] = c;
           }
 
           Location escapeLocation(escapeLine, escapeColumn, line, column);
 
           char *endPtr;
-          auto utf16CodePoint = strtol(escape.c_str(), &endPtr, 16);
-          if (endPtr != escape.c_str() + escape.length()) {
+          auto utf16CodePoint = strtol(escape, &endPtr, 16);
+          if (endPtr != escape + 4) {
             throw SyntaxError("Invalid escape sequence in string",
                               escapeLocation);
           }
 
-          std::string utf8;
+          auto valid = true;
           if (isUTF16Low(utf16CodePoint)) {
             if (lastCodeUnit == -1) {
               throw SyntaxError("Found no high UTF-16 surrogate",
                                 escapeLocation);
             }
 
-            utf8 = utf16ToUTF8(lastCodeUnit, utf16CodePoint);
+            valid = appendUTF8(text, lastCodeUnit, utf16CodePoint);
             lastCodeUnit = -1;
           } else if (lastCodeUnit != -1) {
             throw SyntaxError("Expected low UTF-16 surrogate", escapeLocation);
@@ -988,17 +1530,13 @@ private:
               lastCodeUnit = utf16CodePoint;
               lastCodeUnitLocation = escapeLocation;
             } else {
-              utf8 = utf16ToUTF8(utf16CodePoint, 0);
+              valid = appendUTF8(text, utf16CodePoint, 0);
             }
           }
 
-          if (lastCodeUnit == -1) {
-            if (utf8.empty()) {
-              throw SyntaxError("Invalid escape sequence in string",
-                                combine(lastCodeUnitLocation, escapeLocation));
-            }
-
-            text += utf8;
+          if (!valid) {
+            throw SyntaxError("Invalid escape sequence in string",
+                              combine(lastCodeUnitLocation, escapeLocation));
           }
 
           endLine = line;
@@ -1014,6 +1552,8 @@ private:
         text += c;
       }
 
+      checkStringLength(text, startLocation);
+
       newLine = (newLine && (c == ' ' || c == '\t')) || c == '\n';
     }
 
@@ -1022,30 +1562,31 @@ private:
       auto endPos = text.find_last_not_of(" \n\r\t");
 
       if (startPos == std::string::npos) {
-        text = "";
+        text.clear();
       } else {
-        text = text.substr(startPos, endPos - startPos + 1);
+        text.erase(endPos + 1);
+        text.erase(0, startPos);
       }
     }
 
-    text.shrink_to_fit();
     return Token(TokenKind::String, combine(startLocation, endLine, endColumn),
-                 text);
+                 std::string(text));
   }
 
   Token nextKey(const Location &startLocation, char startChar) {
-    std::string text = std::string(1, startChar);
+    auto &text = context.text;
+    text.assign(1, startChar);
     auto endLine = startLocation.getStartLine();
     auto endColumn = startLocation.getStartColumn();
 
     while (!isDelimiter(lookaheadChar())) {
       text += nextChar(endLine, endColumn);
+      checkStringLength(text, startLocation);
     }
 
     Location location(startLocation.getStartLine(),
                       startLocation.getStartColumn(), endLine, endColumn);
 
-    text.shrink_to_fit();
     if (text == "true") {
       return Token(TokenKind::True, location);
     } else if (text == "false") {
@@ -1053,14 +1594,14 @@ private:
     } else if (text == "null") {
       return Token(TokenKind::Null, location);
     } else {
-      return Token(TokenKind::Key, location, text);
+      return Token(TokenKind::Key, location, std::string(text));
     }
   }
 
   Token next() {
     if (hasLookahead) {
       hasLookahead = false;
-      return lookaheadToken;
+      return std::move(lookaheadToken);
     }
 
     char c;
@@ -1161,45 +1702,41 @@ private:
 
   Token expect(TokenKind kind) { return expect({kind}); }
 
-  Value parseArrayValue(const std::string &path, const Token &start) {
-    std::vector<Value> *values = nullptr;
+  // Parses the items of an array following start, which is [, and calls
+  // parseItem(index) to parse each item. Returns the location of ].
+  template <typename ParseItem>
+  Location parseItems(const Token &start, const ParseItem &parseItem) {
+    auto endLocation = lookahead().location;
 
-    auto token = lookahead();
-    if (token.kind == TokenKind::CloseBrace) {
+    if (lookahead().kind == TokenKind::CloseBrace) {
       next();
-    } else {
-      values = new std::vector<Value>();
-
-      try {
-        while (true) {
-          values->push_back(
-              parseValue(path + "[" + std::to_string(values->size()) + "]"));
-
-          token = lookahead();
-          if (token.kind == TokenKind::Comma) {
-            next();
-          } else if (token.kind == TokenKind::CloseBrace) {
-            next();
-            break;
-          }
-        }
+      return endLocation;
+    }
 
-        values->shrink_to_fit();
-      } catch (...) {
-        delete values;
-        throw;
+    for (size_t count = 1;; ++count) {
+      parseItem(count - 1);
+      checkItemCount(count, start.location);
+
+      auto &token = lookahead();
+      if (token.kind == TokenKind::Comma) {
+        next();
+      } else if (token.kind == TokenKind::CloseBrace) {
+        endLocation = token.location;
+        next();
+        return endLocation;
       }
     }
-
-    return Value::fromArray(combine(start.location, token.location), path,
-                            values != nullptr ? values : &EMPTY_VECTOR);
   }
 
-  Value parseObjectValue(const std::string &path, const Token &start) {
-    std::map<std::string, Value> *values = nullptr;
+  // Parses the entries of an object starting with start, which is either {
+  // or the first key, and calls parseEntry(key) after each colon to parse the
+  // value, which returns its location. Returns the end of the object.
+  template <typename ParseEntry>
+  Location parseEntries(Token &&start, const ParseEntry &parseEntry) {
+    auto startKind = start.kind;
 
     Token token;
-    if (start.kind == TokenKind::OpenCurly) {
+    if (startKind == TokenKind::OpenCurly) {
       token =
           expect({TokenKind::Key, TokenKind::String, TokenKind::CloseCurly});
     } else {
@@ -1208,298 +1745,480 @@ private:
                           start.location);
       }
 
-      token = start;
+      token = std::move(start);
     }
 
     Location endLocation = token.location;
 
     if (token.kind == TokenKind::CloseCurly) {
       // Can only occur if { was before
-    } else {
-      values = new std::map<std::string, Value>();
+      return endLocation;
+    }
 
-      try {
-        auto oldObjectIndent = objectIndent;
-        objectIndent = token.location.getStartColumn();
+    auto oldObjectIndent = objectIndent;
+    objectIndent = token.location.getStartColumn();
 
-        while (true) {
-          auto &itemKey = token.strValue;
-          auto itemPath = path;
-          if (path != ".") {
-            itemPath += ".";
-          }
-          itemPath += escapeKey(itemKey);
+    while (true) {
+      expect(TokenKind::Colon);
 
-          expect(TokenKind::Colon);
+      endLocation = parseEntry(token.strValue);
 
-          auto itemValue = parseValue(itemPath);
-          endLocation = itemValue.location;
+      auto lookaheadKind = lookahead().kind;
+      auto lookaheadLocation = lookahead().location;
+      auto comma = lookaheadKind == TokenKind::Comma;
 
-          auto itr = values->find(itemKey);
-          if (itr == values->end()) {
-            values->emplace(itemKey, std::move(itemValue));
-          } else {
-            itr->second = std::move(itemValue);
-          }
+      if (comma && startKind != TokenKind::OpenCurly &&
+          lookaheadLocation.getStartColumn() < objectIndent) {
+        // A dedented comma separates objects in an array as written by
+        // print()
+        break;
+      } else if (comma) {
+        next();
+        lookaheadKind = lookahead().kind;
+        lookaheadLocation = lookahead().location;
+      } else if (lookaheadKind == TokenKind::CloseCurly) {
+        if (startKind == TokenKind::OpenCurly) {
+          next();
+          endLocation = lookaheadLocation;
+        }
 
-          token = lookahead();
-          auto comma = token.kind == TokenKind::Comma;
+        break;
+      } else if (lookaheadKind == TokenKind::EoD &&
+                 startKind != TokenKind::OpenCurly) {
+        break;
+      }
 
-          if (comma) {
-            next();
-            token = lookahead();
-          } else if (token.kind == TokenKind::CloseCurly) {
-            if (start.kind == TokenKind::OpenCurly) {
-              next();
-              endLocation = token.location;
-            }
+      if (startKind != TokenKind::OpenCurly &&
+          lookaheadLocation.getStartColumn() != objectIndent) {
+        if (comma) {
+          throw SyntaxError("Expected key but none found (check indentation?)",
+                            lookaheadLocation);
+        }
 
-            break;
-          } else if (token.kind == TokenKind::EoD &&
-                     start.kind != TokenKind::OpenCurly) {
-            break;
-          }
+        break;
+      }
 
-          if (start.kind != TokenKind::OpenCurly &&
-              token.location.getStartColumn() != objectIndent) {
-            if (comma) {
-              throw SyntaxError(
-                  "Expected key but none found (check indentation?)",
-                  token.location);
-            }
+      token = expect({TokenKind::Key, TokenKind::String});
+    }
 
-            if (start.kind == TokenKind::OpenCurly) {
-              expect(TokenKind::CloseCurly);
-            }
+    objectIndent = oldObjectIndent;
+    return endLocation;
+  }
 
-            break;
+  Value parseArrayValue(std::string &&path, const Token &start) {
+    // Items are collected in a scratch vector of the context that is reused
+    // across parses, so the final vector is allocated once with exact size
+    auto level = depth - 1;
+    if (context.arrays.size() <= level) {
+      context.arrays.resize(level + 1);
+    }
+    context.arrays[level].clear();
+
+    auto endLocation = parseItems(start, [this, &path, level](size_t i) {
+      auto index = std::to_string(i);
+      std::string itemPath;
+      itemPath.reserve(path.length() + index.length() + 2);
+      itemPath += path;
+      itemPath += '[';
+      itemPath += index;
+      itemPath += ']';
+
+      auto itemValue = parseValue(std::move(itemPath));
+      // parseValue may have resized the outer vector
+      context.arrays[level].push_back(std::move(itemValue));
+    });
+
+    auto &items = context.arrays[level];
+    std::vector<Value> values(std::make_move_iterator(items.begin()),
+                              std::make_move_iterator(items.end()));
+    items.clear();
+
+    return Value::fromArray(combine(start.location, endLocation),
+                            std::move(path), std::move(values));
+  }
+
+  Value parseObjectValue(std::string &&path, Token &&start) {
+    std::map<std::string, Value> values;
+    auto startLocation = start.location;
+
+    auto endLocation = parseEntries(
+        std::move(start),
+        [this, &path, &values, &startLocation](std::string &itemKey) {
+          std::string itemPath;
+          itemPath.reserve(path.length() + itemKey.length() + 3);
+          itemPath += path;
+          if (path != ".") {
+            itemPath += '.';
           }
+          internal::appendEscapedKey(itemPath, itemKey);
 
-          token = expect({TokenKind::Key, TokenKind::String});
-        }
+          auto itemValue = parseValue(std::move(itemPath));
+          auto itemLocation = itemValue.location;
 
-        objectIndent = oldObjectIndent;
-      } catch (...) {
-        delete values;
-        throw;
-      }
+          auto itr = values.find(itemKey);
+          if (itr == values.end()) {
+            values.emplace(std::move(itemKey), std::move(itemValue));
+            checkItemCount(values.size(), startLocation);
+          } else {
+            itr->second = std::move(itemValue);
+          }
+
+          return itemLocation;
+        });
+
+    return Value::fromObject(combine(startLocation, endLocation),
+                             std::move(path), std::move(values));
+  }
+
+  // Counts a value against maxNodes and reads its first token
+  Token valueToken() {
+    if (options.maxNodes != 0 && ++nodeCount > options.maxNodes) {
+      throw LimitExceededError("Data exceeds the maximum number of values",
+                               lookahead().location);
     }
 
-    return Value::fromObject(combine(start.location, endLocation), path,
-                             values != nullptr ? values : &EMPTY_MAP);
+    return expect({TokenKind::True, TokenKind::False, TokenKind::Int,
+                   TokenKind::Float, TokenKind::Key, TokenKind::String,
+                   TokenKind::Null, TokenKind::OpenBrace,
+                   TokenKind::OpenCurly});
   }
 
-  Value parseValue(const std::string &path) {
+  Value parseValue(std::string &&path) {
     DepthHandler depthHandler(options, depth);
 
-    auto token =
-        expect({TokenKind::True, TokenKind::False, TokenKind::Int,
-                TokenKind::Float, TokenKind::Key, TokenKind::String,
-                TokenKind::Null, TokenKind::OpenBrace, TokenKind::OpenCurly});
+    auto token = valueToken();
 
     switch (token.kind) {
     case TokenKind::True:
-      return Value::fromBool(token.location, path, true);
+      return Value::fromBool(token.location, std::move(path), true);
     case TokenKind::False:
-      return Value::fromBool(token.location, path, false);
+      return Value::fromBool(token.location, std::move(path), false);
     case TokenKind::Int:
-      return Value::fromInt(token.location, path, token.intValue);
+      return Value::fromInt(token.location, std::move(path), token.intValue);
     case TokenKind::Float:
-      return Value::fromFloat(token.location, path, token.floatValue);
+      return Value::fromFloat(token.location, std::move(path),
+                              token.floatValue);
     case TokenKind::Key:
-      return parseObjectValue(path, token);
+      return parseObjectValue(std::move(path), std::move(token));
     case TokenKind::String: {
       if (lookahead().kind == TokenKind::Colon) {
-        return parseObjectValue(path, token);
+        return parseObjectValue(std::move(path), std::move(token));
       }
 
-      return Value::fromString(token.location, path, token.strValue);
+      return Value::fromString(token.location, std::move(path),
+                               std::move(token.strValue));
     }
     case TokenKind::Null:
-      return Value::fromNull(token.location, path);
+      return Value::fromNull(token.location, std::move(path));
     case TokenKind::OpenBrace:
-      return parseArrayValue(path, token);
+      return parseArrayValue(std::move(path), token);
     case TokenKind::OpenCurly:
-      return parseObjectValue(path, token);
+      return parseObjectValue(std::move(path), std::move(token));
     default:
       unreachable();
     }
   }
 
-public:
-  explicit Parser(std::istream &stream, const Options &options)
-      : stream(stream), options(options), nextLine(1), nextColumn(1),
-        objectIndent(0), hasLookahead(false), depth(0) {}
+  // Lets bind decode the current item or entry and skips it if it did not.
+  // Returns the location of the value.
+  template <typename Bind> Location decodeItem(const Bind &bind) {
+    pendingValue = true;
+    bind();
 
-  Value parse() {
-    auto value = parseValue(".");
-    expect(TokenKind::EoD);
-    return value;
+    if (pendingValue) {
+      static SkippingBinder skipper;
+
+      pendingValue = false;
+      valueLocation = decodeValue(skipper);
+    }
+
+    return valueLocation;
   }
-};
 
-const Options DEFAULT_OPTIONS = {1024};
+  Location decodeArray(Binder &binder, const Token &start) {
+    binder.beginArray(*this, start.location);
 
-Value parse(std::istream &stream, const Options &options) {
-  return Parser(stream, options).parse();
-}
+    auto length = decodePath.length();
+    auto endLocation = parseItems(start, [this, &binder, length](size_t i) {
+      decodePath += '[';
+      decodePath += std::to_string(i);
+      decodePath += ']';
 
-static void print(std::ostream &stream, const Value &value, int32_t indent,
-                  bool topMost) {
-  switch (value.getKind()) {
-  case Value::Kind::Bool: {
-    stream << (value.asBool() ? "true" : "false");
-    break;
-  }
-  case Value::Kind::Int: {
-    stream << value.asInt();
-    break;
-  }
-  case Value::Kind::Float: {
-    stream << value.asFloat();
-    break;
-  }
-  case Value::Kind::String: {
-    stream << escape(value.asString());
-    break;
+      decodeItem([this, &binder, i]() {
+        binder.bindItem(*this, static_cast<uint32_t>(i));
+      });
+      decodePath.resize(length);
+    });
+
+    auto location = combine(start.location, endLocation);
+    binder.endArray(*this, location);
+    return location;
   }
-  case Value::Kind::Null: {
-    stream << "null";
-    break;
+
+  Location decodeObject(Binder &binder, Token &&start) {
+    auto startLocation = start.location;
+    binder.beginObject(*this, startLocation);
+
+    auto length = decodePath.length();
+    size_t count = 0;
+    auto endLocation = parseEntries(
+        std::move(start),
+        [this, &binder, length, &count, &startLocation](std::string &key) {
+          if (length != 1) {
+            decodePath += '.';
+          }
+          internal::appendEscapedKey(decodePath, key);
+
+          auto location = decodeItem(
+              [this, &binder, &key]() { binder.bindEntry(*this, key); });
+          decodePath.resize(length);
+          checkItemCount(++count, startLocation);
+          return location;
+        });
+
+    auto location = combine(startLocation, endLocation);
+    binder.endObject(*this, location);
+    return location;
   }
-  case Value::Kind::Array: {
-    stream << "[";
-    if (value.getItemCount() == 0) {
-      stream << "]";
-    } else {
-      indent += 2;
 
-      for (uint32_t i = 0; i < value.getItemCount(); ++i) {
-        if (i > 0 && value.item(i - 1).getKind() == Value::Kind::Object) {
-          stream << "\n" << std::string(indent - 2, ' ') << ",";
-        }
+  Location decodeValue(Binder &binder) {
+    DepthHandler depthHandler(options, depth);
 
-        stream << "\n" << std::string(indent, ' ');
-        print(stream, value.item(i), indent, false);
+    auto token = valueToken();
+
+    switch (token.kind) {
+    case TokenKind::True:
+      binder.bindBool(*this, true, token.location);
+      break;
+    case TokenKind::False:
+      binder.bindBool(*this, false, token.location);
+      break;
+    case TokenKind::Int:
+      binder.bindInt(*this, token.intValue, token.location);
+      break;
+    case TokenKind::Float:
+      binder.bindFloat(*this, token.floatValue, token.location);
+      break;
+    case TokenKind::Key:
+      return decodeObject(binder, std::move(token));
+    case TokenKind::String: {
+      if (lookahead().kind == TokenKind::Colon) {
+        return decodeObject(binder, std::move(token));
       }
 
-      indent -= 2;
-      stream << "\n" << std::string(indent, ' ') << "]";
+      binder.bindString(*this, std::move(token.strValue), token.location);
+      break;
     }
-    break;
+    case TokenKind::Null:
+      binder.bindNull(*this, token.location);
+      break;
+    case TokenKind::OpenBrace:
+      return decodeArray(binder, token);
+    case TokenKind::OpenCurly:
+      return decodeObject(binder, std::move(token));
+    default:
+      unreachable();
+    }
+
+    return token.location;
   }
-  case Value::Kind::Object: {
-    if (value.getItemCount() == 0) {
-      stream << "{}";
-    } else {
-      if (!topMost) {
-        indent += 2;
-      }
 
-      auto first = true;
-      for (auto &key : value.keys()) {
-        auto &itemValue = value.item(key);
+public:
+  explicit Parser(ParserContext &context, std::istream &stream,
+                  const Options &options)
+      : context(context), stream(stream), options(options), nextLine(1),
+        nextColumn(1), objectIndent(0), hasLookahead(false), depth(0),
+        consumedBytes(0), nextCheckpoint(0),
+        nextProgress(options.progressInterval), nodeCount(0), decodePath("."),
+        pendingValue(false), valueLocation(Location::unknown()) {
+    updateCheckpoint();
+  }
 
-        if (first) {
-          first = false;
-        } else {
-          stream << "\n" << std::string(indent, ' ');
-        }
+  Value parse() {
+    auto value = parseValue(std::string("."));
+    expect(TokenKind::EoD);
+    return value;
+  }
 
-        stream << escapeKey(key) << ":";
+  void parse(Binder &binder) {
+    decodeValue(binder);
+    expect(TokenKind::EoD);
+  }
 
-        if (itemValue.getKind() == Value::Kind::Object) {
-          stream << "\n" << std::string(indent + 2, ' ');
-        } else {
-          stream << " ";
-        }
-        print(stream, itemValue, indent, false);
-      }
+  Location decode(Binder &binder) override {
+    if (!pendingValue) {
+      throw std::logic_error("Only the current item or entry can be decoded");
     }
-    break;
+
+    pendingValue = false;
+    valueLocation = decodeValue(binder);
+    return valueLocation;
   }
-  default:
-    unreachable();
+
+  const std::string &path() const override { return decodePath; }
+};
+
+const Options DEFAULT_OPTIONS = {1024, 0, 0, nullptr, nullptr, 0, 0, 0, 0, 0};
+
+ParserContext::ParserContext() = default;
+
+// Calls parse with a parser reading stream, or reading it ahead on another
+// thread if enabled in options
+template <typename Parse>
+static auto withParser(ParserContext &context, std::istream &stream,
+                       const Options &options, const Parse &parse)
+    -> decltype(parse(std::declval<Parser &>())) {
+  if (options.readAheadBuffers != 0) {
+    ReadAheadBuffer buffer(stream, options.readAheadBuffers,
+                           options.readAheadBufferSize != 0
+                               ? options.readAheadBufferSize
+                               : ReadAheadBuffer::DEFAULT_BUFFER_SIZE);
+    std::istream readAheadStream(&buffer);
+    // Rethrows errors of the reader thread instead of ending the data early
+    readAheadStream.exceptions(std::ios::badbit);
+
+    Parser parser(context, readAheadStream, options);
+    return parse(parser);
   }
+
+  Parser parser(context, stream, options);
+  return parse(parser);
 }
 
-void print(std::ostream &stream, const Value &value) {
-  print(stream, value, 0, true);
+Value ParserContext::parse(std::istream &stream, const Options &options) {
+  return withParser(*this, stream, options,
+                    [](Parser &parser) { return parser.parse(); });
 }
 
-std::string escapeKey(const std::string &str) {
-  if (str.find_first_of(" \"\'\n\r\t\\.[],{}") == std::string::npos) {
-    return str;
-  }
+void ParserContext::parse(std::istream &stream, Binder &binder,
+                          const Options &options) {
+  withParser(*this, stream, options,
+             [&binder](Parser &parser) { parser.parse(binder); });
+}
 
-  return escape(str);
+Value parse(std::istream &stream, const Options &options) {
+  ParserContext context;
+  return context.parse(stream, options);
 }
 
-std::string escape(const std::string &str) {
-  std::string result = "\"";
+void parse(std::istream &stream, Binder &binder, const Options &options) {
+  ParserContext context;
+  context.parse(stream, binder, options);
+}
 
-  if (!str.empty()) {
-    result.reserve(2 + str.length());
+ReadAheadBuffer::ReadAheadBuffer(std::istream &stream, uint32_t bufferCount,
+                                 uint32_t bufferSize)
+    : ReadAheadBuffer(
+          [&stream](char *buffer, size_t size) -> size_t {
+            if (!stream.good()) {
+              return 0;
+            }
 
-    size_t pos = 0;
-    size_t nextUnprocessed = 0;
+            stream.read(buffer, static_cast<std::streamsize>(size));
+            return static_cast<size_t>(stream.gcount());
+          },
+          bufferCount, bufferSize) {}
+
+ReadAheadBuffer::ReadAheadBuffer(const Source &source, uint32_t bufferCount,
+                                 uint32_t bufferSize)
+    : source(source),
+      buffers(bufferCount != 0 ? bufferCount : 1,
+              std::vector<char>(bufferSize != 0 ? bufferSize
+                                                : DEFAULT_BUFFER_SIZE)),
+      lengths(buffers.size(), 0), readIndex(0), writeIndex(0), filled(0),
+      holding(false), finished(false), stopped(false) {
+  thread = std::thread(&ReadAheadBuffer::run, this);
+}
 
+ReadAheadBuffer::~ReadAheadBuffer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+  }
+
+  condition.notify_all();
+  thread.join();
+}
+
+void ReadAheadBuffer::run() {
+  try {
     while (true) {
-      pos = str.find_first_of("\"\'\b\f\n\r\t\\", pos);
-      if (pos == std::string::npos) {
-        break;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() {
+          return stopped || filled + (holding ? 1 : 0) < buffers.size();
+        });
+
+        if (stopped) {
+          return;
+        }
       }
 
-      if (pos != nextUnprocessed) {
-        result += str.substr(nextUnprocessed, pos - nextUnprocessed);
-      }
+      // The slot at writeIndex is neither filled nor held by the consumer, so
+      // it can be written without holding the lock.
+      auto &buffer = buffers[writeIndex];
+      auto length = source(buffer.data(), buffer.size());
 
-      switch (str[pos]) {
-      case '"': {
-        result += "\\\"";
-        break;
-      }
-      case '\'': {
-        result += "\\'";
-        break;
-      }
-      case '\b': {
-        result += "\\b";
-        break;
-      }
-      case '\f': {
-        result += "\\f";
-        break;
-      }
-      case '\n': {
-        result += "\\n";
-        break;
-      }
-      case '\r': {
-        result += "\\r";
-        break;
-      }
-      case '\t': {
-        result += "\\t";
-        break;
-      }
-      case '\\': {
-        result += "\\\\";
-        break;
-      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (length == 0) {
+          finished = true;
+        } else {
+          lengths[writeIndex] = length;
+          writeIndex = (writeIndex + 1) % buffers.size();
+          ++filled;
+        }
       }
 
-      ++pos;
-      nextUnprocessed = pos;
+      condition.notify_all();
+
+      if (length == 0) {
+        return;
+      }
+    }
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      error = std::current_exception();
+      finished = true;
     }
 
-    if (nextUnprocessed != str.length()) {
-      result += str.substr(nextUnprocessed);
+    condition.notify_all();
+  }
+}
+
+ReadAheadBuffer::int_type ReadAheadBuffer::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+
+  if (holding) {
+    holding = false;
+    readIndex = (readIndex + 1) % buffers.size();
+    setg(nullptr, nullptr, nullptr);
+    condition.notify_all();
+  }
+
+  condition.wait(lock, [this]() { return filled != 0 || finished; });
+
+  if (filled == 0) {
+    if (error) {
+      std::rethrow_exception(error);
     }
+
+    return traits_type::eof();
   }
 
-  result += "\"";
-  return result;
+  --filled;
+  holding = true;
+
+  auto begin = buffers[readIndex].data();
+  setg(begin, begin, begin + lengths[readIndex]);
+
+  return traits_type::to_int_type(*gptr());
 }
 
 } // namespace cppcson
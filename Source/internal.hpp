@@ -0,0 +1,93 @@
+#pragma once
+#include "cppcson.hpp"
+#include <string>
+
+namespace cppcson {
+namespace internal {
+
+// Appends str quoted and escaped to out.
+void appendEscaped(std::string &out, const std::string &str);
+
+// Appends str quoted and escaped according to JSON to out.
+void appendJsonEscaped(std::string &out, const std::string &str);
+
+// Appends str to out, quoted and escaped only if it cannot be used as a bare
+// key.
+void appendEscapedKey(std::string &out, const std::string &str);
+
+// Upper bound of the characters written by formatInt() and formatFloat()
+const size_t MAX_NUMBER_LENGTH = 32;
+
+// Writes the decimal representation of value to buffer and returns its
+// length.
+size_t formatInt(char *buffer, int64_t value);
+
+// Writes the shortest representation of value that reads back as the same
+// float to buffer and returns its length.
+size_t formatFloat(char *buffer, double value);
+
+// Formatted output of a container at one position of a document. Nested
+// containers are left out and written from their own caches at the recorded
+// offsets, so modifying them never invalidates the cache of their parent.
+// The caches of a container in other formats follow in next.
+struct SerializationCache {
+  struct Child {
+    size_t offset;
+    const Value *value;
+    uint32_t indent;
+    bool topMost;
+  };
+
+  WriterOptions::Format format;
+  uint32_t indent;
+  bool topMost;
+  std::string text;
+  std::vector<Child> children;
+  SerializationCache *next;
+
+  SerializationCache() : next(nullptr) {}
+
+  SerializationCache(const SerializationCache &) = delete;
+
+  ~SerializationCache() { delete next; }
+};
+
+// Items of a container, shared by clones of a value
+template <typename Items> struct Shared {
+  std::atomic<uint32_t> references;
+  Items items;
+
+  explicit Shared(Items &&items) : references(1), items(std::move(items)) {}
+};
+
+// Finalizer of SplitMix64, a bijection spreading every input bit over all
+// output bits
+inline uint64_t mixBits(uint64_t value) {
+  value += 0x9e3779b97f4a7c15;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+  return value ^ (value >> 31);
+}
+
+// Mixes each 64 bit word into the state with mixBits(), which is fast enough
+// to not dominate loading snapshots or checking cached files. Not
+// cryptographic, but changed bits cannot cancel out like in word-wise FNV.
+uint64_t hashBytes(const char *data, size_t length);
+
+// Stream buffer reading file contents that are already in memory
+class MemoryBuffer : public std::streambuf {
+public:
+  explicit MemoryBuffer(std::string &data) {
+    setg(&data[0], &data[0], &data[0] + data.length());
+  }
+};
+
+// Reads the whole file, throwing std::system_error if it cannot be opened.
+std::string readFile(const std::string &fileName);
+
+void appendInt(std::string &out, int64_t value);
+
+void appendFloat(std::string &out, double value);
+
+} // namespace internal
+} // namespace cppcson
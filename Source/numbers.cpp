@@ -0,0 +1,426 @@
+#include "internal.hpp"
+#include <cmath>
+#include <cstring>
+
+// Shortest round trip formatting of doubles based on the Grisu2 algorithm by
+// Florian Loitsch ("Printing Floating-Point Numbers Quickly and Accurately
+// with Integers", PLDI 2010). The output always parses back to the same
+// double and is the shortest such representation in the vast majority of
+// cases.
+
+namespace cppcson {
+
+static const char DIGIT_PAIRS[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+namespace {
+// Floating point number f * 2^e with a 64 bit significand
+struct DiyFp {
+  uint64_t f;
+  int e;
+
+  DiyFp(uint64_t f, int e) : f(f), e(e) {}
+
+  DiyFp minus(const DiyFp &other) const { return DiyFp(f - other.f, e); }
+
+  // Product rounded to the upper 64 bits
+  DiyFp times(const DiyFp &other) const {
+    auto aLow = f & 0xFFFFFFFFu;
+    auto aHigh = f >> 32u;
+    auto bLow = other.f & 0xFFFFFFFFu;
+    auto bHigh = other.f >> 32u;
+
+    auto lowLow = aLow * bLow;
+    auto lowHigh = aLow * bHigh;
+    auto highLow = aHigh * bLow;
+    auto highHigh = aHigh * bHigh;
+
+    auto middle = (lowLow >> 32u) + (lowHigh & 0xFFFFFFFFu) +
+                  (highLow & 0xFFFFFFFFu) + (1u << 31u);
+
+    return DiyFp(highHigh + (lowHigh >> 32u) + (highLow >> 32u) +
+                     (middle >> 32u),
+                 e + other.e + 64);
+  }
+
+  DiyFp normalized() const {
+    auto result = *this;
+
+    while ((result.f >> 63u) == 0) {
+      result.f <<= 1u;
+      --result.e;
+    }
+
+    return result;
+  }
+
+  DiyFp normalizedTo(int targetE) const {
+    return DiyFp(f << static_cast<unsigned>(e - targetE), targetE);
+  }
+};
+
+struct CachedPower {
+  uint64_t f;
+  int e;
+  int k;
+};
+} // namespace
+
+// Normalized approximations of 10^k for k = -300, -292, ..., 324
+static const CachedPower CACHED_POWERS[] = {
+    {0xAB70FE17C79AC6CA, -1060, -300},
+    {0xFF77B1FCBEBCDC4F, -1034, -292},
+    {0xBE5691EF416BD60C, -1007, -284},
+    {0x8DD01FAD907FFC3C, -980, -276},
+    {0xD3515C2831559A83, -954, -268},
+    {0x9D71AC8FADA6C9B5, -927, -260},
+    {0xEA9C227723EE8BCB, -901, -252},
+    {0xAECC49914078536D, -874, -244},
+    {0x823C12795DB6CE57, -847, -236},
+    {0xC21094364DFB5637, -821, -228},
+    {0x9096EA6F3848984F, -794, -220},
+    {0xD77485CB25823AC7, -768, -212},
+    {0xA086CFCD97BF97F4, -741, -204},
+    {0xEF340A98172AACE5, -715, -196},
+    {0xB23867FB2A35B28E, -688, -188},
+    {0x84C8D4DFD2C63F3B, -661, -180},
+    {0xC5DD44271AD3CDBA, -635, -172},
+    {0x936B9FCEBB25C996, -608, -164},
+    {0xDBAC6C247D62A584, -582, -156},
+    {0xA3AB66580D5FDAF6, -555, -148},
+    {0xF3E2F893DEC3F126, -529, -140},
+    {0xB5B5ADA8AAFF80B8, -502, -132},
+    {0x87625F056C7C4A8B, -475, -124},
+    {0xC9BCFF6034C13053, -449, -116},
+    {0x964E858C91BA2655, -422, -108},
+    {0xDFF9772470297EBD, -396, -100},
+    {0xA6DFBD9FB8E5B88F, -369, -92},
+    {0xF8A95FCF88747D94, -343, -84},
+    {0xB94470938FA89BCF, -316, -76},
+    {0x8A08F0F8BF0F156B, -289, -68},
+    {0xCDB02555653131B6, -263, -60},
+    {0x993FE2C6D07B7FAC, -236, -52},
+    {0xE45C10C42A2B3B06, -210, -44},
+    {0xAA242499697392D3, -183, -36},
+    {0xFD87B5F28300CA0E, -157, -28},
+    {0xBCE5086492111AEB, -130, -20},
+    {0x8CBCCC096F5088CC, -103, -12},
+    {0xD1B71758E219652C, -77, -4},
+    {0x9C40000000000000, -50, 4},
+    {0xE8D4A51000000000, -24, 12},
+    {0xAD78EBC5AC620000, 3, 20},
+    {0x813F3978F8940984, 30, 28},
+    {0xC097CE7BC90715B3, 56, 36},
+    {0x8F7E32CE7BEA5C70, 83, 44},
+    {0xD5D238A4ABE98068, 109, 52},
+    {0x9F4F2726179A2245, 136, 60},
+    {0xED63A231D4C4FB27, 162, 68},
+    {0xB0DE65388CC8ADA8, 189, 76},
+    {0x83C7088E1AAB65DB, 216, 84},
+    {0xC45D1DF942711D9A, 242, 92},
+    {0x924D692CA61BE758, 269, 100},
+    {0xDA01EE641A708DEA, 295, 108},
+    {0xA26DA3999AEF774A, 322, 116},
+    {0xF209787BB47D6B85, 348, 124},
+    {0xB454E4A179DD1877, 375, 132},
+    {0x865B86925B9BC5C2, 402, 140},
+    {0xC83553C5C8965D3D, 428, 148},
+    {0x952AB45CFA97A0B3, 455, 156},
+    {0xDE469FBD99A05FE3, 481, 164},
+    {0xA59BC234DB398C25, 508, 172},
+    {0xF6C69A72A3989F5C, 534, 180},
+    {0xB7DCBF5354E9BECE, 561, 188},
+    {0x88FCF317F22241E2, 588, 196},
+    {0xCC20CE9BD35C78A5, 614, 204},
+    {0x98165AF37B2153DF, 641, 212},
+    {0xE2A0B5DC971F303A, 667, 220},
+    {0xA8D9D1535CE3B396, 694, 228},
+    {0xFB9B7CD9A4A7443C, 720, 236},
+    {0xBB764C4CA7A44410, 747, 244},
+    {0x8BAB8EEFB6409C1A, 774, 252},
+    {0xD01FEF10A657842C, 800, 260},
+    {0x9B10A4E5E9913129, 827, 268},
+    {0xE7109BFBA19C0C9D, 853, 276},
+    {0xAC2820D9623BF429, 880, 284},
+    {0x80444B5E7AA7CF85, 907, 292},
+    {0xBF21E44003ACDD2D, 933, 300},
+    {0x8E679C2F5E44FF8F, 960, 308},
+    {0xD433179D9C8CB841, 986, 316},
+    {0x9E19DB92B4E31BA9, 1013, 324},
+};
+
+static const int CACHED_POWERS_MIN_DEC_EXP = -300;
+static const int CACHED_POWERS_DEC_STEP = 8;
+
+// Range of the binary exponent after scaling by a cached power
+static const int ALPHA = -60;
+static const int GAMMA = -32;
+
+// Returns a cached power c such that ALPHA <= e + c.e + 64 <= GAMMA
+static const CachedPower &cachedPowerFor(int e) {
+  auto f = ALPHA - e - 1;
+  // Computes ceil(f * log10(2)) with 78913 / 2^18 approximating log10(2)
+  auto k = (f * 78913) / (1 << 18) + (f > 0 ? 1 : 0);
+  auto index = (-CACHED_POWERS_MIN_DEC_EXP + k + (CACHED_POWERS_DEC_STEP - 1)) /
+               CACHED_POWERS_DEC_STEP;
+
+  return CACHED_POWERS[index];
+}
+
+static uint32_t largestPow10(uint32_t n, int &exponent) {
+  static const uint32_t POWERS[] = {
+      1,      10,      100,      1000,      10000,
+      100000, 1000000, 10000000, 100000000, 1000000000};
+
+  exponent = 10;
+  while (exponent > 1 && n < POWERS[exponent - 1]) {
+    --exponent;
+  }
+
+  return POWERS[exponent - 1];
+}
+
+static void roundWeed(char *buffer, int length, uint64_t distance,
+                      uint64_t delta, uint64_t rest, uint64_t tenK) {
+  // Moves the last digit towards the exact value as long as the result stays
+  // inside the rounding interval
+  while (rest < distance && delta - rest >= tenK &&
+         (rest + tenK < distance || distance - rest > rest + tenK - distance)) {
+    --buffer[length - 1];
+    rest += tenK;
+  }
+}
+
+static void generateDigits(char *buffer, int &length, int &decimalExponent,
+                           DiyFp low, DiyFp w, DiyFp high) {
+  auto delta = high.minus(low).f;
+  auto distance = high.minus(w).f;
+
+  auto shift = static_cast<unsigned>(-high.e);
+  auto one = uint64_t(1) << shift;
+
+  auto integral = static_cast<uint32_t>(high.f >> shift);
+  auto fractional = high.f & (one - 1);
+
+  int remaining;
+  auto divisor = largestPow10(integral, remaining);
+
+  while (remaining > 0) {
+    auto digit = integral / divisor;
+    integral %= divisor;
+    buffer[length++] = static_cast<char>('0' + digit);
+    --remaining;
+
+    auto rest = (static_cast<uint64_t>(integral) << shift) + fractional;
+    if (rest <= delta) {
+      decimalExponent += remaining;
+      roundWeed(buffer, length, distance, delta, rest,
+                static_cast<uint64_t>(divisor) << shift);
+      return;
+    }
+
+    divisor /= 10;
+  }
+
+  auto fractionalDigits = 0;
+  while (true) {
+    fractional *= 10;
+    delta *= 10;
+    distance *= 10;
+
+    buffer[length++] = static_cast<char>('0' + (fractional >> shift));
+    fractional &= one - 1;
+    ++fractionalDigits;
+
+    if (fractional <= delta) {
+      break;
+    }
+  }
+
+  decimalExponent -= fractionalDigits;
+  roundWeed(buffer, length, distance, delta, fractional, one);
+}
+
+// Writes the shortest digits of a positive finite value so that value equals
+// digits * 10^decimalExponent after reading it back.
+static void grisu2(double value, char *buffer, int &length,
+                   int &decimalExponent) {
+  const int SIGNIFICAND_BITS = 52;
+  const int EXPONENT_BIAS = 1023 + SIGNIFICAND_BITS;
+  const uint64_t HIDDEN_BIT = uint64_t(1) << SIGNIFICAND_BITS;
+
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+
+  auto biasedExponent = static_cast<int>(bits >> SIGNIFICAND_BITS);
+  auto significand = bits & (HIDDEN_BIT - 1);
+
+  auto v = biasedExponent == 0 ? DiyFp(significand, 1 - EXPONENT_BIAS)
+                               : DiyFp(significand + HIDDEN_BIT,
+                                       biasedExponent - EXPONENT_BIAS);
+
+  // Boundaries halfway to the neighbouring doubles. The lower neighbour is
+  // closer if the significand is a power of two.
+  auto lowerIsCloser = significand == 0 && biasedExponent > 1;
+  auto high = DiyFp(2 * v.f + 1, v.e - 1).normalized();
+  auto low = lowerIsCloser ? DiyFp(4 * v.f - 1, v.e - 2)
+                           : DiyFp(2 * v.f - 1, v.e - 1);
+  low = low.normalizedTo(high.e);
+
+  auto &cached = cachedPowerFor(high.e);
+  DiyFp power(cached.f, cached.e);
+
+  auto w = v.normalized().times(power);
+  auto scaledLow = low.times(power);
+  auto scaledHigh = high.times(power);
+
+  // Shrinks the interval by one unit to account for the rounding of times()
+  scaledLow.f += 1;
+  scaledHigh.f -= 1;
+
+  length = 0;
+  decimalExponent = -cached.k;
+  generateDigits(buffer, length, decimalExponent, scaledLow, w, scaledHigh);
+}
+
+static char *formatExponent(char *pos, int exponent) {
+  *pos++ = 'e';
+
+  if (exponent < 0) {
+    *pos++ = '-';
+    exponent = -exponent;
+  } else {
+    *pos++ = '+';
+  }
+
+  if (exponent >= 100) {
+    *pos++ = static_cast<char>('0' + exponent / 100);
+    exponent %= 100;
+  }
+
+  std::memcpy(pos, DIGIT_PAIRS + exponent * 2, 2);
+  return pos + 2;
+}
+
+size_t internal::formatFloat(char *buffer, double value) {
+  auto pos = buffer;
+
+  if (std::isnan(value)) {
+    std::memcpy(pos, "nan", 3);
+    return 3;
+  }
+
+  if (std::signbit(value)) {
+    *pos++ = '-';
+    value = -value;
+  }
+
+  if (std::isinf(value)) {
+    std::memcpy(pos, "inf", 3);
+    return static_cast<size_t>(pos - buffer) + 3;
+  }
+
+  if (value == 0) {
+    std::memcpy(pos, "0.0", 3);
+    return static_cast<size_t>(pos - buffer) + 3;
+  }
+
+  char digits[32];
+  int length;
+  int decimalExponent;
+  grisu2(value, digits, length, decimalExponent);
+
+  // Position of the decimal point relative to the first digit
+  auto point = length + decimalExponent;
+
+  // The output always contains a dot or an exponent, so it is read back as a
+  // float instead of an integer
+  if (length <= point && point <= 15) {
+    std::memcpy(pos, digits, static_cast<size_t>(length));
+    pos += length;
+    std::memset(pos, '0', static_cast<size_t>(point - length));
+    pos += point - length;
+    *pos++ = '.';
+    *pos++ = '0';
+  } else if (0 < point && point <= 15) {
+    std::memcpy(pos, digits, static_cast<size_t>(point));
+    pos += point;
+    *pos++ = '.';
+    std::memcpy(pos, digits + point, static_cast<size_t>(length - point));
+    pos += length - point;
+  } else if (-4 < point && point <= 0) {
+    *pos++ = '0';
+    *pos++ = '.';
+    std::memset(pos, '0', static_cast<size_t>(-point));
+    pos += -point;
+    std::memcpy(pos, digits, static_cast<size_t>(length));
+    pos += length;
+  } else {
+    *pos++ = digits[0];
+    if (length > 1) {
+      *pos++ = '.';
+      std::memcpy(pos, digits + 1, static_cast<size_t>(length - 1));
+      pos += length - 1;
+    }
+
+    pos = formatExponent(pos, point - 1);
+  }
+
+  return static_cast<size_t>(pos - buffer);
+}
+
+size_t internal::formatInt(char *buffer, int64_t value) {
+  char digits[20];
+  auto end = digits + sizeof(digits);
+  auto pos = end;
+
+  // Negating the minimum is undefined for signed types
+  auto magnitude = value < 0 ? 0 - static_cast<uint64_t>(value)
+                             : static_cast<uint64_t>(value);
+
+  while (magnitude >= 100) {
+    auto pair = (magnitude % 100) * 2;
+    magnitude /= 100;
+    pos -= 2;
+    pos[0] = DIGIT_PAIRS[pair];
+    pos[1] = DIGIT_PAIRS[pair + 1];
+  }
+
+  if (magnitude >= 10) {
+    auto pair = magnitude * 2;
+    pos -= 2;
+    pos[0] = DIGIT_PAIRS[pair];
+    pos[1] = DIGIT_PAIRS[pair + 1];
+  } else {
+    *--pos = static_cast<char>('0' + magnitude);
+  }
+
+  auto length = static_cast<size_t>(end - pos);
+  auto sign = value < 0 ? 1 : 0;
+  if (sign != 0) {
+    buffer[0] = '-';
+  }
+
+  std::memcpy(buffer + sign, pos, length);
+  return length + sign;
+}
+
+void internal::appendInt(std::string &out, int64_t value) {
+  char buffer[MAX_NUMBER_LENGTH];
+  out.append(buffer, formatInt(buffer, value));
+}
+
+void internal::appendFloat(std::string &out, double value) {
+  char buffer[MAX_NUMBER_LENGTH];
+  out.append(buffer, formatFloat(buffer, value));
+}
+
+} // namespace cppcson
@@ -0,0 +1,235 @@
+#include "internal.hpp"
+#include <algorithm>
+
+namespace cppcson {
+
+class Patcher {
+private:
+  using Segment = Path::Segment;
+
+  std::vector<PatchOperation> &patch;
+  std::string path;
+
+  static bool isContainer(const Value &value) {
+    return value.kind == Value::Kind::Array ||
+           value.kind == Value::Kind::Object;
+  }
+
+  static bool sharesItems(const Value &a, const Value &b) {
+    if (a.kind == Value::Kind::Array) {
+      return a.nonStrValue.arrayValue == b.nonStrValue.arrayValue;
+    }
+
+    return a.nonStrValue.objectValue == b.nonStrValue.objectValue;
+  }
+
+  // Paths are built like the parser builds them for getPath()
+  void appendIndex(size_t index) {
+    path += '[';
+    path += std::to_string(index);
+    path += ']';
+  }
+
+  void appendKey(const std::string &key) {
+    if (path != ".") {
+      path += '.';
+    }
+    internal::appendEscapedKey(path, key);
+  }
+
+  void addOperation(PatchOperation::Kind kind, Value &&value) {
+    patch.push_back({kind, path, std::move(value)});
+  }
+
+  void diffArrays(const std::vector<Value> &from,
+                  const std::vector<Value> &to) {
+    auto length = path.length();
+    auto common = std::min(from.size(), to.size());
+
+    for (size_t i = 0; i < common; ++i) {
+      appendIndex(i);
+      diffValues(from[i], to[i]);
+      path.resize(length);
+    }
+
+    for (auto i = common; i < to.size(); ++i) {
+      appendIndex(i);
+      addOperation(PatchOperation::Kind::Add, to[i].clone());
+      path.resize(length);
+    }
+
+    // Removed from the back, so that earlier indexes stay valid
+    for (auto i = from.size(); i > common; --i) {
+      appendIndex(i - 1);
+      addOperation(PatchOperation::Kind::Remove, Value::newNull());
+      path.resize(length);
+    }
+  }
+
+  void diffObjects(const std::map<std::string, Value> &from,
+                   const std::map<std::string, Value> &to) {
+    auto length = path.length();
+    auto fromItr = from.begin();
+    auto toItr = to.begin();
+
+    // Both maps are sorted by key, so a single merge pass pairs them up
+    while (fromItr != from.end() || toItr != to.end()) {
+      int order;
+      if (fromItr == from.end()) {
+        order = 1;
+      } else if (toItr == to.end()) {
+        order = -1;
+      } else {
+        order = fromItr->first.compare(toItr->first);
+      }
+
+      if (order < 0) {
+        appendKey(fromItr->first);
+        addOperation(PatchOperation::Kind::Remove, Value::newNull());
+        ++fromItr;
+      } else if (order > 0) {
+        appendKey(toItr->first);
+        addOperation(PatchOperation::Kind::Add, toItr->second.clone());
+        ++toItr;
+      } else {
+        appendKey(fromItr->first);
+        diffValues(fromItr->second, toItr->second);
+        ++fromItr;
+        ++toItr;
+      }
+
+      path.resize(length);
+    }
+  }
+
+  void diffValues(const Value &from, const Value &to) {
+    if (from.kind != to.kind || !isContainer(from)) {
+      if (from.compare(to) != 0) {
+        addOperation(PatchOperation::Kind::Replace, to.clone());
+      }
+      return;
+    }
+
+    // Relies on hashBytes() mixing every bit, so that different contents
+    // collide with negligible probability
+    if (sharesItems(from, to) || from.hash() == to.hash()) {
+      return;
+    }
+
+    if (from.kind == Value::Kind::Array) {
+      diffArrays(from.nonStrValue.arrayValue->items,
+                 to.nonStrValue.arrayValue->items);
+    } else {
+      diffObjects(from.nonStrValue.objectValue->items,
+                  to.nonStrValue.objectValue->items);
+    }
+  }
+
+  static Path parsePath(const std::string &path) {
+    try {
+      return Path(path);
+    } catch (const PathError &e) {
+      throw PatchError(e.what());
+    }
+  }
+
+  static Value &child(Value &parent, const Segment &segment,
+                      const std::string &parentPath) {
+    if (segment.isIndex) {
+      parent.ensureKind(Value::Kind::Array);
+      if (segment.index >= parent.getItemCount()) {
+        throw OutOfRangeError(segment.index, parentPath, parent.location);
+      }
+
+      parent.invalidateCache();
+      return parent.modifiableItems()[segment.index];
+    }
+
+    if (!parent.contains(segment.key)) {
+      throw MissingKeyError(segment.key, parentPath, parent.location);
+    }
+
+    parent.invalidateCache();
+    return parent.modifiableEntries().find(segment.key)->second;
+  }
+
+  static void applyOperation(Value &root, const PatchOperation &operation) {
+    auto &path = operation.path;
+    auto parsed = parsePath(path);
+    auto &segments = parsed.segments;
+
+    if (segments.empty()) {
+      if (operation.kind == PatchOperation::Kind::Remove) {
+        throw PatchError("Cannot remove the root value");
+      }
+
+      root = operation.value.clone();
+      return;
+    }
+
+    auto parent = &root;
+    for (size_t i = 0; i + 1 < segments.size(); ++i) {
+      parent = &child(*parent, segments[i], path.substr(0, segments[i].start));
+    }
+
+    auto &last = segments.back();
+    auto parentPath = path.substr(0, last.start);
+
+    switch (operation.kind) {
+    case PatchOperation::Kind::Add:
+      if (last.isIndex) {
+        parent->ensureKind(Value::Kind::Array);
+        if (last.index > parent->getItemCount()) {
+          throw OutOfRangeError(last.index, parentPath, parent->location);
+        }
+
+        parent->add(last.index, operation.value.clone());
+      } else {
+        if (parent->contains(last.key)) {
+          throw PatchError("Key " + escapeKey(last.key) +
+                           " already exists under " + parentPath);
+        }
+
+        parent->add(last.key, operation.value.clone());
+      }
+      break;
+    case PatchOperation::Kind::Remove:
+      if (last.isIndex) {
+        parent->ensureKind(Value::Kind::Array);
+        if (!parent->remove(last.index)) {
+          throw OutOfRangeError(last.index, parentPath, parent->location);
+        }
+      } else if (!parent->remove(last.key)) {
+        throw MissingKeyError(last.key, parentPath, parent->location);
+      }
+      break;
+    case PatchOperation::Kind::Replace:
+      child(*parent, last, parentPath) = operation.value.clone();
+      break;
+    }
+  }
+
+public:
+  explicit Patcher(std::vector<PatchOperation> &patch)
+      : patch(patch), path(".") {}
+
+  void diff(const Value &from, const Value &to) { diffValues(from, to); }
+
+  static void apply(Value &value, const std::vector<PatchOperation> &patch) {
+    for (auto &operation : patch) {
+      applyOperation(value, operation);
+    }
+  }
+};
+
+std::vector<PatchOperation> diff(const Value &from, const Value &to) {
+  std::vector<PatchOperation> patch;
+  Patcher(patch).diff(from, to);
+  return patch;
+}
+
+void apply(Value &value, const std::vector<PatchOperation> &patch) {
+  Patcher::apply(value, patch);
+}
+
+} // namespace cppcson
@@ -0,0 +1,430 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <sstream>
+
+namespace cppcson {
+
+// Rule indexes of entries that accept any value or no value at all
+static const size_t ANY_RULE = SIZE_MAX;
+static const size_t NO_RULE = SIZE_MAX - 1;
+
+static const uint32_t ALL_KINDS = (1u << 7u) - 1;
+
+static uint32_t kindBit(Value::Kind kind) {
+  return 1u << static_cast<uint32_t>(kind);
+}
+
+static std::string formatNumber(double value) {
+  std::ostringstream stream;
+  stream << value;
+  return stream.str();
+}
+
+// Checks that are shared by validating values and parse events
+class Schema::Checker {
+protected:
+  const std::vector<Rule> &rules;
+  std::vector<Violation> &violations;
+
+  void add(const std::string &path, const Location &location,
+           std::string &&message) {
+    violations.push_back({path, std::move(message), location});
+  }
+
+  bool checkKind(const Rule &rule, Value::Kind kind, const std::string &path,
+                 const Location &location) {
+    if ((rule.kinds & kindBit(kind)) != 0) {
+      return true;
+    }
+
+    std::string expected;
+    for (uint32_t i = 0; i < 7; ++i) {
+      if ((rule.kinds & (1u << i)) != 0) {
+        if (!expected.empty()) {
+          expected += " or ";
+        }
+        expected += kindName(static_cast<Value::Kind>(i));
+      }
+    }
+
+    add(path, location,
+        "Expected " + expected + " value but found " + kindName(kind));
+    return false;
+  }
+
+  void checkScalar(const Rule &rule, const Value &value,
+                   const std::string &path, const Location &location) {
+    if (!checkKind(rule, value.getKind(), path, location)) {
+      return;
+    }
+
+    if (!rule.allowed.empty() &&
+        !std::binary_search(rule.allowed.begin(), rule.allowed.end(), value)) {
+      add(path, location, "Value is not one of the allowed values");
+    }
+
+    if (!value.isInt() && !value.isFloat()) {
+      return;
+    }
+
+    auto number = value.isInt() ? static_cast<double>(value.asInt())
+                                : value.asFloat();
+    if (rule.hasMinimum && number < rule.minimum) {
+      add(path, location,
+          "Value is less than the minimum " + formatNumber(rule.minimum));
+    }
+    if (rule.hasMaximum && number > rule.maximum) {
+      add(path, location,
+          "Value is greater than the maximum " + formatNumber(rule.maximum));
+    }
+  }
+
+  void checkCount(const Rule &rule, size_t count, const std::string &path,
+                  const Location &location) {
+    if (count < rule.minItems) {
+      add(path, location,
+          "Expected at least " + std::to_string(rule.minItems) + " items");
+    }
+    if (count > rule.maxItems) {
+      add(path, location,
+          "Expected at most " + std::to_string(rule.maxItems) + " items");
+    }
+  }
+
+  void checkRequired(const Rule &rule, const std::vector<bool> &found,
+                     const std::string &path, const Location &location) {
+    for (size_t i = 0; i < rule.required.size(); ++i) {
+      if (!found[i]) {
+        add(path, location,
+            "Key " + escapeKey(rule.required[i]) + " does not exist");
+      }
+    }
+  }
+
+  // Rule of the entry with key, also marking it as found if required
+  static size_t entryRule(const Rule &rule, const std::string &key,
+                          std::vector<bool> &found) {
+    auto required =
+        std::lower_bound(rule.required.begin(), rule.required.end(), key);
+    if (required != rule.required.end() && *required == key) {
+      found[static_cast<size_t>(required - rule.required.begin())] = true;
+    }
+
+    auto property = std::lower_bound(
+        rule.properties.begin(), rule.properties.end(), key,
+        [](const std::pair<std::string, size_t> &property,
+           const std::string &key) { return property.first < key; });
+    if (property != rule.properties.end() && property->first == key) {
+      return property->second;
+    }
+
+    return rule.additional;
+  }
+
+  void rejectKey(const std::string &key, const std::string &path,
+                 const Location &location) {
+    add(path, location, "Key " + escapeKey(key) + " is not allowed");
+  }
+
+public:
+  explicit Checker(const Schema &schema, std::vector<Violation> &violations)
+      : rules(schema.rules), violations(violations) {}
+
+  void checkValue(size_t index, const Value &value, std::string &path) {
+    if (index == ANY_RULE) {
+      return;
+    }
+
+    auto &rule = rules[index];
+    auto &location = value.getLocation();
+    auto length = path.length();
+
+    if (value.isArray()) {
+      if (!checkKind(rule, Value::Kind::Array, path, location)) {
+        return;
+      }
+
+      for (uint32_t i = 0; i < value.getItemCount(); ++i) {
+        path += '[';
+        path += std::to_string(i);
+        path += ']';
+        checkValue(rule.items, value.item(i), path);
+        path.resize(length);
+      }
+
+      checkCount(rule, value.getItemCount(), path, location);
+    } else if (value.isObject()) {
+      if (!checkKind(rule, Value::Kind::Object, path, location)) {
+        return;
+      }
+
+      std::vector<bool> found(rule.required.size(), false);
+      for (auto &key : value.keys()) {
+        if (length != 1) {
+          path += '.';
+        }
+        internal::appendEscapedKey(path, key);
+
+        auto &item = value.item(key);
+        auto itemRule = entryRule(rule, key, found);
+        if (itemRule == NO_RULE) {
+          rejectKey(key, path, item.getLocation());
+        } else {
+          checkValue(itemRule, item, path);
+        }
+        path.resize(length);
+      }
+
+      checkRequired(rule, found, path, location);
+      checkCount(rule, value.getItemCount(), path, location);
+    } else {
+      checkScalar(rule, value, path, location);
+    }
+  }
+};
+
+// Checks the values of one array item or object entry as they are parsed.
+// Containers of other kinds are reported at their end, covering their whole
+// location like when validating values.
+class Schema::StreamChecker : public Schema::Checker, public Binder {
+private:
+  size_t index;
+  bool matches;
+  size_t count;
+  std::vector<bool> found;
+
+  void scalar(Decoder &decoder, Value &&value, const Location &location) {
+    if (index != ANY_RULE) {
+      checkScalar(rules[index], value, decoder.path(), location);
+    }
+  }
+
+  void begin(Value::Kind kind) {
+    matches = index == ANY_RULE || (rules[index].kinds & kindBit(kind)) != 0;
+    count = 0;
+  }
+
+  void item(Decoder &decoder, size_t itemIndex) {
+    ++count;
+
+    if (matches && itemIndex != ANY_RULE) {
+      StreamChecker checker(*this, itemIndex);
+      decoder.decode(checker);
+    }
+  }
+
+  bool end(Decoder &decoder, Value::Kind kind, const Location &location) {
+    if (index == ANY_RULE) {
+      return false;
+    }
+
+    auto &rule = rules[index];
+    if (!matches) {
+      checkKind(rule, kind, decoder.path(), location);
+      return false;
+    }
+
+    checkCount(rule, count, decoder.path(), location);
+    return true;
+  }
+
+public:
+  explicit StreamChecker(const Checker &checker, size_t index)
+      : Checker(checker), index(index), matches(false), count(0) {}
+
+  Value::Kind expected() const override { return Value::Kind::Null; }
+
+  void bindNull(Decoder &decoder, const Location &location) override {
+    scalar(decoder, Value::newNull(), location);
+  }
+
+  void bindBool(Decoder &decoder, bool value,
+                const Location &location) override {
+    scalar(decoder, Value::newBool(value), location);
+  }
+
+  void bindInt(Decoder &decoder, int64_t value,
+               const Location &location) override {
+    scalar(decoder, Value::newInt(value), location);
+  }
+
+  void bindFloat(Decoder &decoder, double value,
+                 const Location &location) override {
+    scalar(decoder, Value::newFloat(value), location);
+  }
+
+  void bindString(Decoder &decoder, std::string &&value,
+                  const Location &location) override {
+    scalar(decoder, Value::newString(std::move(value)), location);
+  }
+
+  void beginArray(Decoder &, const Location &) override {
+    begin(Value::Kind::Array);
+  }
+
+  void bindItem(Decoder &decoder, uint32_t) override {
+    item(decoder, index != ANY_RULE ? rules[index].items : ANY_RULE);
+  }
+
+  void endArray(Decoder &decoder, const Location &location) override {
+    end(decoder, Value::Kind::Array, location);
+  }
+
+  void beginObject(Decoder &, const Location &) override {
+    begin(Value::Kind::Object);
+    if (index != ANY_RULE) {
+      found.assign(rules[index].required.size(), false);
+    }
+  }
+
+  void bindEntry(Decoder &decoder, const std::string &key) override {
+    if (index == ANY_RULE || !matches) {
+      ++count;
+      return;
+    }
+
+    auto itemIndex = entryRule(rules[index], key, found);
+    if (itemIndex != NO_RULE) {
+      item(decoder, itemIndex);
+      return;
+    }
+
+    ++count;
+    StreamChecker checker(*this, ANY_RULE);
+    rejectKey(key, decoder.path(), decoder.decode(checker));
+  }
+
+  void endObject(Decoder &decoder, const Location &location) override {
+    // The value checker reports missing keys before the count
+    if (index != ANY_RULE && matches) {
+      checkRequired(rules[index], found, decoder.path(), location);
+    }
+    end(decoder, Value::Kind::Object, location);
+  }
+};
+
+const char *Schema::kindName(Value::Kind kind) { return Value::toString(kind); }
+
+Schema::Schema(const Value &definition) { compile(definition); }
+
+size_t Schema::compile(const Value &definition) {
+  auto index = rules.size();
+  rules.push_back({ALL_KINDS, false, false, 0, 0, 0, UINT32_MAX, {}, {}, {},
+                   ANY_RULE, ANY_RULE});
+
+  // Compiling children adds rules, so the rule is filled in at the end
+  Rule rule{ALL_KINDS, false, false, 0, 0, 0, UINT32_MAX, {}, {}, {},
+            ANY_RULE, ANY_RULE};
+
+  auto number = [](const Value &value) {
+    return value.isInt() ? static_cast<double>(value.asInt())
+                         : value.asFloat();
+  };
+
+  auto count = [](const Value &value) {
+    auto count = value.asInt();
+    if (count < 0 || count > UINT32_MAX) {
+      throw SchemaError("Invalid item count in " + value.getPath(),
+                        value.getLocation());
+    }
+    return static_cast<uint32_t>(count);
+  };
+
+  definition.asObject();
+  for (auto &keyword : definition.keys()) {
+    auto &value = definition.item(keyword);
+
+    if (keyword == "type") {
+      rule.kinds = 0;
+      auto addKind = [&rule](const Value &name) {
+        if (name.asString() == "number") {
+          rule.kinds |= kindBit(Value::Kind::Int) | kindBit(Value::Kind::Float);
+          return;
+        }
+
+        for (uint32_t i = 0; i < 7; ++i) {
+          if (name.asString() == kindName(static_cast<Value::Kind>(i))) {
+            rule.kinds |= 1u << i;
+            return;
+          }
+        }
+
+        throw SchemaError("Unknown type " + name.asString() + " in " +
+                              name.getPath(),
+                          name.getLocation());
+      };
+
+      if (value.isArray()) {
+        for (auto &name : value) {
+          addKind(name);
+        }
+      } else {
+        addKind(value);
+      }
+    } else if (keyword == "enum") {
+      for (auto &allowed : value.asArray()) {
+        if (allowed.isArray() || allowed.isObject()) {
+          throw SchemaError("Only scalars are supported in " +
+                                allowed.getPath(),
+                            allowed.getLocation());
+        }
+        rule.allowed.push_back(allowed.clone());
+      }
+      std::sort(rule.allowed.begin(), rule.allowed.end());
+    } else if (keyword == "minimum") {
+      rule.hasMinimum = true;
+      rule.minimum = number(value);
+    } else if (keyword == "maximum") {
+      rule.hasMaximum = true;
+      rule.maximum = number(value);
+    } else if (keyword == "minItems") {
+      rule.minItems = count(value);
+    } else if (keyword == "maxItems") {
+      rule.maxItems = count(value);
+    } else if (keyword == "required") {
+      for (auto &key : value.asArray()) {
+        rule.required.push_back(key.asString());
+      }
+      std::sort(rule.required.begin(), rule.required.end());
+      rule.required.erase(
+          std::unique(rule.required.begin(), rule.required.end()),
+          rule.required.end());
+    } else if (keyword == "properties") {
+      // Keys are visited in sorted order
+      for (auto &key : value.asObject().keys()) {
+        auto itemIndex = compile(value.item(key));
+        rule.properties.emplace_back(key, itemIndex);
+      }
+    } else if (keyword == "additionalProperties") {
+      if (value.isBool()) {
+        rule.additional = value.asBool() ? ANY_RULE : NO_RULE;
+      } else {
+        rule.additional = compile(value);
+      }
+    } else if (keyword == "items") {
+      rule.items = compile(value);
+    }
+  }
+
+  rules[index] = std::move(rule);
+  return index;
+}
+
+std::vector<Violation> Schema::validate(const Value &value) const {
+  std::vector<Violation> violations;
+  std::string path(".");
+
+  Checker(*this, violations).checkValue(0, value, path);
+  return violations;
+}
+
+std::vector<Violation> Schema::validate(std::istream &stream,
+                                        const Options &options) const {
+  std::vector<Violation> violations;
+  StreamChecker checker(Checker(*this, violations), 0);
+
+  parse(stream, checker, options);
+  return violations;
+}
+
+} // namespace cppcson
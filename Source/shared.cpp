@@ -0,0 +1,123 @@
+#include "internal.hpp"
+
+namespace cppcson {
+
+// Stripe of the calling thread, assigned round robin on first use
+static size_t threadStripe(size_t stripes) {
+  static std::atomic<size_t> nextStripe(0);
+  static thread_local size_t stripe =
+      nextStripe.fetch_add(1, std::memory_order_relaxed);
+
+  return stripe % stripes;
+}
+
+SharedDocument::Snapshot::Snapshot(std::atomic<uint64_t> *readers,
+                                   const Value *value)
+    : readers(readers), value(value) {}
+
+SharedDocument::Snapshot::Snapshot(Snapshot &&other) noexcept
+    : readers(other.readers), value(other.value) {
+  other.readers = nullptr;
+  other.value = nullptr;
+}
+
+SharedDocument::Snapshot::~Snapshot() {
+  if (readers != nullptr) {
+    readers->fetch_sub(1, std::memory_order_release);
+  }
+}
+
+SharedDocument::Snapshot &
+SharedDocument::Snapshot::operator=(Snapshot &&other) noexcept {
+  if (readers != nullptr) {
+    readers->fetch_sub(1, std::memory_order_release);
+  }
+
+  readers = other.readers;
+  value = other.value;
+  other.readers = nullptr;
+  other.value = nullptr;
+  return *this;
+}
+
+const Value &SharedDocument::Snapshot::operator*() const { return *value; }
+
+const Value *SharedDocument::Snapshot::operator->() const { return value; }
+
+const Value *SharedDocument::Snapshot::get() const { return value; }
+
+SharedDocument::SharedDocument(Value &&value)
+    : root(new Value(std::move(value))), epoch(0) {
+  for (auto &stripe : stripes) {
+    stripe.readers[0] = 0;
+    stripe.readers[1] = 0;
+  }
+}
+
+SharedDocument::~SharedDocument() { delete root.load(); }
+
+// Readers count themselves in the stripe of the epoch they started in. The
+// next epoch only starts once no reader is left in the one before the current
+// epoch. Readers that started in the current epoch may still see a root
+// replaced during it, but after two more epochs all of them are gone, and
+// readers starting later only see newer roots.
+bool SharedDocument::tryAdvance() {
+  auto current = epoch.load();
+
+  for (auto &stripe : stripes) {
+    if (stripe.readers[(current + 1) & 1].load() != 0) {
+      return false;
+    }
+  }
+
+  epoch.store(current + 1);
+  return true;
+}
+
+void SharedDocument::reclaim() {
+  while (!retired.empty() && epoch.load() < retired.back().epoch + 2) {
+    if (!tryAdvance()) {
+      break;
+    }
+  }
+
+  auto current = epoch.load();
+  auto end = retired.begin();
+  while (end != retired.end() && current >= end->epoch + 2) {
+    ++end;
+  }
+
+  retired.erase(retired.begin(), end);
+}
+
+SharedDocument::Snapshot SharedDocument::pin() const {
+  auto &readers = stripes[threadStripe(STRIPES)].readers[epoch.load() & 1];
+  readers.fetch_add(1);
+
+  return Snapshot(&readers, root.load());
+}
+
+void SharedDocument::publish(Value &&value) {
+  std::unique_ptr<const Value> next(new Value(std::move(value)));
+  std::lock_guard<std::mutex> lock(writerMutex);
+
+  // Reserved first, as the replaced root must not be destroyed by a failure
+  retired.reserve(retired.size() + 1);
+  std::unique_ptr<const Value> previous(root.exchange(next.release()));
+  retired.push_back({std::move(previous), epoch.load()});
+  reclaim();
+}
+
+void SharedDocument::synchronize() {
+  std::unique_lock<std::mutex> lock(writerMutex);
+
+  reclaim();
+  while (!retired.empty()) {
+    lock.unlock();
+    std::this_thread::yield();
+    lock.lock();
+    reclaim();
+  }
+}
+
+} // namespace cppcson
@@ -0,0 +1,294 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace cppcson {
+
+// Writes are noticed when the file is closed, or per write for files kept
+// open. Renames and deletions cover editors that replace files.
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO |
+                                   IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR;
+
+[[noreturn]] static void fail(const std::string &message) {
+  throw std::system_error(errno, std::generic_category(), message);
+}
+
+static bool isCsonFile(const std::string &name) {
+  static const std::string SUFFIX = ".cson";
+
+  return name.length() > SUFFIX.length() &&
+         name.compare(name.length() - SUFFIX.length(), SUFFIX.length(),
+                      SUFFIX) == 0;
+}
+
+static std::string join(const std::string &directory, const std::string &name) {
+  return directory.back() == '/' ? directory + name : directory + "/" + name;
+}
+
+std::string FileWatcher::Directory::fileName(const std::string &name) const {
+  auto itr = files.find(name);
+  if (itr != files.end()) {
+    return itr->second;
+  }
+
+  return all && isCsonFile(name) ? join(path, name) : "";
+}
+
+FileWatcher::FileWatcher(Callback callback, uint32_t debounceMilliseconds,
+                         const Options &options)
+    : callback(std::move(callback)), debounce(debounceMilliseconds),
+      options(options),
+      inotifyDescriptor(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+      wakeDescriptor(-1) {
+  if (inotifyDescriptor < 0) {
+    fail("Cannot initialize inotify");
+  }
+
+  wakeDescriptor = eventfd(0, EFD_CLOEXEC);
+  if (wakeDescriptor < 0) {
+    auto error = errno;
+    close(inotifyDescriptor);
+    errno = error;
+    fail("Cannot create event descriptor");
+  }
+
+  thread = std::thread(&FileWatcher::run, this);
+}
+
+FileWatcher::~FileWatcher() {
+  // The thread stops once the descriptor becomes readable
+  uint64_t value = 1;
+  auto written = write(wakeDescriptor, &value, sizeof(value));
+  (void)written;
+
+  thread.join();
+  close(wakeDescriptor);
+  close(inotifyDescriptor);
+}
+
+int FileWatcher::addDirectory(const std::string &path) {
+  auto descriptor =
+      inotify_add_watch(inotifyDescriptor, path.c_str(), WATCH_MASK);
+  if (descriptor < 0) {
+    fail("Cannot watch " + path);
+  }
+
+  return descriptor;
+}
+
+void FileWatcher::watch(const std::string &path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    fail("Cannot watch " + path);
+  }
+
+  std::vector<std::string> fileNames;
+
+  if (S_ISDIR(info.st_mode)) {
+    auto directoryPath = path;
+    while (directoryPath.length() > 1 && directoryPath.back() == '/') {
+      directoryPath.pop_back();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto &directory = directories[addDirectory(directoryPath)];
+      directory.path = directoryPath;
+      directory.all = true;
+    }
+
+    std::unique_ptr<DIR, int (*)(DIR *)> handle(opendir(directoryPath.c_str()),
+                                                closedir);
+    if (!handle) {
+      fail("Cannot read " + directoryPath);
+    }
+
+    while (auto entry = readdir(handle.get())) {
+      std::string name(entry->d_name);
+      if (isCsonFile(name)) {
+        fileNames.push_back(join(directoryPath, name));
+      }
+    }
+  } else {
+    auto slash = path.rfind('/');
+    auto directoryPath = slash == std::string::npos
+                             ? std::string(".")
+                             : path.substr(0, std::max<size_t>(slash, 1));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &directory = directories[addDirectory(directoryPath)];
+    if (directory.path.empty()) {
+      directory.path = directoryPath;
+    }
+    directory.files[path.substr(slash + 1)] = path;
+    fileNames.push_back(path);
+  }
+
+  for (auto &fileName : fileNames) {
+    FileChange change;
+    load(fileName, change);
+  }
+}
+
+std::shared_ptr<const Value>
+FileWatcher::document(const std::string &fileName) const {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto itr = files.find(fileName);
+  return itr != files.end() ? itr->second.document : nullptr;
+}
+
+bool FileWatcher::load(const std::string &fileName, FileChange &change) {
+  std::shared_ptr<const std::string> previousContents;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto itr = files.find(fileName);
+    if (itr != files.end()) {
+      previousContents = itr->second.contents;
+      change.previous = itr->second.document;
+    }
+  }
+
+  change.fileName = fileName;
+  change.document = change.previous;
+
+  auto contents = std::make_shared<std::string>(internal::readFile(fileName));
+  if (change.previous && *contents == *previousContents) {
+    return false;
+  }
+
+  internal::MemoryBuffer buffer(*contents);
+  std::istream stream(&buffer);
+  change.document = std::make_shared<const Value>(parse(stream, options));
+  if (change.previous) {
+    change.patch = diff(*change.previous, *change.document);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  files[fileName] = File{std::move(contents), change.document};
+  return true;
+}
+
+void FileWatcher::reload(const std::string &fileName) {
+  FileChange change;
+
+  if (access(fileName.c_str(), F_OK) != 0 && errno == ENOENT) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto itr = files.find(fileName);
+      if (itr == files.end()) {
+        return;
+      }
+
+      change.fileName = fileName;
+      change.previous = itr->second.document;
+      files.erase(itr);
+    }
+
+    callback(change);
+    return;
+  }
+
+  try {
+    if (!load(fileName, change)) {
+      return;
+    }
+  } catch (...) {
+    change.error = std::current_exception();
+  }
+
+  callback(change);
+}
+
+void FileWatcher::readEvents(
+    std::map<std::string, std::chrono::steady_clock::time_point> &pending) {
+  alignas(inotify_event) char buffer[4096];
+  auto deadline = std::chrono::steady_clock::now() + debounce;
+
+  // The descriptor is non-blocking, so reading stops once all queued events
+  // are consumed
+  while (true) {
+    auto length = read(inotifyDescriptor, buffer, sizeof(buffer));
+    if (length <= 0) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (ssize_t pos = 0; pos < length;) {
+      auto event = reinterpret_cast<const inotify_event *>(buffer + pos);
+      pos += sizeof(inotify_event) + event->len;
+
+      if ((event->mask & IN_Q_OVERFLOW) != 0) {
+        // Events were lost, so every loaded file may have changed
+        for (auto &file : files) {
+          pending[file.first] = deadline;
+        }
+        continue;
+      }
+
+      auto itr = directories.find(event->wd);
+      if (event->len == 0 || itr == directories.end()) {
+        continue;
+      }
+
+      auto fileName = itr->second.fileName(event->name);
+      if (!fileName.empty()) {
+        pending[fileName] = deadline;
+      }
+    }
+  }
+}
+
+void FileWatcher::run() {
+  std::map<std::string, std::chrono::steady_clock::time_point> pending;
+
+  while (true) {
+    // Sleeps until the next debounced reload is due
+    auto timeout = -1;
+    if (!pending.empty()) {
+      auto next = pending.begin()->second;
+      for (auto &entry : pending) {
+        next = std::min(next, entry.second);
+      }
+
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           next - std::chrono::steady_clock::now())
+                           .count();
+      timeout = static_cast<int>(std::max<int64_t>(remaining + 1, 0));
+    }
+
+    pollfd descriptors[] = {{inotifyDescriptor, POLLIN, 0},
+                            {wakeDescriptor, POLLIN, 0}};
+    if (poll(descriptors, 2, timeout) < 0 && errno != EINTR) {
+      return;
+    }
+
+    if (descriptors[1].revents != 0) {
+      return;
+    }
+
+    if (descriptors[0].revents != 0) {
+      readEvents(pending);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (auto itr = pending.begin(); itr != pending.end();) {
+      if (itr->second <= now) {
+        auto fileName = itr->first;
+        itr = pending.erase(itr);
+        reload(fileName);
+      } else {
+        ++itr;
+      }
+    }
+  }
+}
+
+} // namespace cppcson
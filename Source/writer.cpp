@@ -0,0 +1,1239 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <system_error>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPPCSON_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace cppcson {
+
+[[noreturn]] static void unreachable() {
+  throw std::runtime_error("Unreachable code reached");
+}
+
+// A newline followed by spaces so indentation is appended with one copy
+static const char NEWLINE_INDENT[] =
+    "\n                                                                "
+    "                                                                ";
+static const uint32_t MAX_NEWLINE_INDENT = sizeof(NEWLINE_INDENT) - 2;
+
+static bool isKeyChar(char c) {
+  switch (c) {
+  case ' ':
+  case '"':
+  case '\'':
+  case '\n':
+  case '\r':
+  case '\t':
+  case '\\':
+  case '.':
+  case '[':
+  case ']':
+  case ',':
+  case '{':
+  case '}':
+    return false;
+  default:
+    return true;
+  }
+}
+
+static const char *escapeSequence(char c) {
+  switch (c) {
+  case '"':
+    return "\\\"";
+  case '\'':
+    return "\\'";
+  case '\b':
+    return "\\b";
+  case '\f':
+    return "\\f";
+  case '\n':
+    return "\\n";
+  case '\r':
+    return "\\r";
+  case '\t':
+    return "\\t";
+  case '\\':
+    return "\\\\";
+  default:
+    return nullptr;
+  }
+}
+
+// Scanning for characters to escape is done on 16 (SSE2) or 8 (SWAR) bytes at
+// once. The vector checks only find candidates, which are then checked
+// exactly, so the scan of strings without escapes runs at nearly memcpy speed.
+
+static bool isStringCandidate(uint8_t c) {
+  return c < 0x20 || c == '"' || c == '\'' || c == '\\';
+}
+
+#ifdef CPPCSON_SSE2
+static unsigned countTrailingZeros(unsigned mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// Mask of the bytes in chunk that are less than or equal to limit
+static __m128i lessEqual(__m128i chunk, char limit) {
+  return _mm_cmpeq_epi8(_mm_min_epu8(chunk, _mm_set1_epi8(limit)), chunk);
+}
+
+static __m128i equal(__m128i chunk, char c) {
+  return _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c));
+}
+#else
+static const uint64_t ONES = ~static_cast<uint64_t>(0) / 255;
+static const uint64_t HIGH_BITS = ONES * 0x80;
+
+// Whether any byte of word is less than n (n <= 128)
+static bool hasLess(uint64_t word, uint8_t n) {
+  return ((word - ONES * n) & ~word & HIGH_BITS) != 0;
+}
+
+static bool hasByte(uint64_t word, uint8_t c) {
+  return hasLess(word ^ (ONES * c), 1);
+}
+#endif
+
+// Returns the position of the first byte at or after pos that may have to be
+// escaped in a string or length if there is none.
+static size_t findStringCandidate(const char *data, size_t pos,
+                                  size_t length) {
+#ifdef CPPCSON_SSE2
+  for (; pos + 16 <= length; pos += 16) {
+    auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    auto candidates = _mm_or_si128(
+        _mm_or_si128(lessEqual(chunk, 0x1F), equal(chunk, '"')),
+        _mm_or_si128(equal(chunk, '\''), equal(chunk, '\\')));
+
+    auto mask = static_cast<unsigned>(_mm_movemask_epi8(candidates));
+    if (mask != 0) {
+      return pos + countTrailingZeros(mask);
+    }
+  }
+#else
+  for (; pos + 8 <= length; pos += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + pos, 8);
+
+    if (hasLess(word, 0x20) || hasByte(word, '"') || hasByte(word, '\'') ||
+        hasByte(word, '\\')) {
+      break;
+    }
+  }
+#endif
+
+  for (; pos < length; ++pos) {
+    if (isStringCandidate(static_cast<uint8_t>(data[pos]))) {
+      return pos;
+    }
+  }
+
+  return length;
+}
+
+// Returns whether str is empty or contains a character that cannot appear in
+// an unquoted key.
+static bool needsQuotedKey(const std::string &str) {
+  auto data = str.data();
+  auto length = str.length();
+  size_t pos = 0;
+
+  if (length == 0) {
+    return true;
+  }
+
+#ifdef CPPCSON_SSE2
+  // Candidates are all bytes up to '.' as well as '[', '\\', ']', '{' and '}'
+  for (; pos + 16 <= length; pos += 16) {
+    auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    auto brackets = _mm_and_si128(lessEqual(chunk, ']'),
+                                  _mm_xor_si128(lessEqual(chunk, 'Z'),
+                                                _mm_set1_epi8(-1)));
+    auto candidates = _mm_or_si128(
+        _mm_or_si128(lessEqual(chunk, '.'), brackets),
+        _mm_or_si128(equal(chunk, '{'), equal(chunk, '}')));
+
+    auto mask = static_cast<unsigned>(_mm_movemask_epi8(candidates));
+    while (mask != 0) {
+      if (!isKeyChar(data[pos + countTrailingZeros(mask)])) {
+        return true;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; pos < length; ++pos) {
+    if (!isKeyChar(data[pos])) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Outputs of the serializer provide:
+// - append(char) and append(data, length) for generated text,
+// - appendStored(data, length) for text taken unchanged from a value, which
+//   stays valid as long as the value is neither changed nor destroyed,
+// - checkpoint() called after each value, e.g. to flush buffered output.
+
+namespace {
+struct StringOutput {
+  std::string &out;
+
+  explicit StringOutput(std::string &out) : out(out) {}
+
+  void append(char c) { out += c; }
+
+  void append(const char *data, size_t length) { out.append(data, length); }
+
+  void appendStored(const char *data, size_t length) {
+    out.append(data, length);
+  }
+
+  void checkpoint() {}
+};
+
+struct CountingOutput {
+  size_t length;
+
+  CountingOutput() : length(0) {}
+
+  void append(char) { ++length; }
+
+  void append(const char *, size_t length) { this->length += length; }
+
+  void appendStored(const char *, size_t length) { this->length += length; }
+
+  void checkpoint() {}
+};
+
+struct FixedOutput {
+  char *pos;
+  char *end;
+
+  explicit FixedOutput(char *buffer, size_t size)
+      : pos(buffer), end(buffer + size) {}
+
+  void ensure(size_t length) {
+    if (static_cast<size_t>(end - pos) < length) {
+      throw std::length_error("Buffer is too small for the serialized value");
+    }
+  }
+
+  void append(char c) {
+    ensure(1);
+    *pos++ = c;
+  }
+
+  void append(const char *data, size_t length) {
+    ensure(length);
+    std::memcpy(pos, data, length);
+    pos += length;
+  }
+
+  void appendStored(const char *data, size_t length) { append(data, length); }
+
+  void checkpoint() {}
+};
+
+struct FragmentOutput {
+  struct Pending {
+    const char *data;
+    size_t offset;
+    size_t length;
+  };
+
+  std::string &storage;
+  size_t minReferenceLength;
+  std::vector<Pending> pending;
+  size_t runStart;
+
+  explicit FragmentOutput(std::string &storage, size_t minReferenceLength)
+      : storage(storage), minReferenceLength(minReferenceLength),
+        runStart(storage.length()) {}
+
+  void endRun() {
+    if (runStart != storage.length()) {
+      pending.push_back({nullptr, runStart, storage.length() - runStart});
+      runStart = storage.length();
+    }
+  }
+
+  void append(char c) { storage += c; }
+
+  void append(const char *data, size_t length) { storage.append(data, length); }
+
+  void appendStored(const char *data, size_t length) {
+    if (length < minReferenceLength) {
+      storage.append(data, length);
+    } else {
+      endRun();
+      pending.push_back({data, 0, length});
+    }
+  }
+
+  void checkpoint() {}
+
+  // Resolves the fragments once storage does not move anymore
+  void finish(std::vector<Fragment> &fragments) {
+    endRun();
+
+    for (auto &fragment : pending) {
+      fragments.push_back(
+          {fragment.data != nullptr ? fragment.data
+                                    : storage.data() + fragment.offset,
+           fragment.length});
+    }
+  }
+};
+
+struct CacheOutput {
+  internal::SerializationCache &cache;
+
+  explicit CacheOutput(internal::SerializationCache &cache) : cache(cache) {}
+
+  void append(char c) { cache.text += c; }
+
+  void append(const char *data, size_t length) {
+    cache.text.append(data, length);
+  }
+
+  void appendStored(const char *data, size_t length) {
+    cache.text.append(data, length);
+  }
+
+  // Records the position of a nested container written from its own cache
+  void appendChild(const Value &value, uint32_t indent, bool topMost) {
+    cache.children.push_back({cache.text.length(), &value, indent, topMost});
+  }
+
+  void checkpoint() {}
+};
+
+struct WriterOutput {
+  std::string &out;
+  size_t flushThreshold;
+  Writer &writer;
+
+  explicit WriterOutput(std::string &out, size_t flushThreshold,
+                        Writer &writer)
+      : out(out), flushThreshold(flushThreshold), writer(writer) {}
+
+  void append(char c) { out += c; }
+
+  void append(const char *data, size_t length) { out.append(data, length); }
+
+  void appendStored(const char *data, size_t length) {
+    out.append(data, length);
+  }
+
+  void checkpoint() {
+    if (out.length() >= flushThreshold) {
+      writer.flush();
+    }
+  }
+};
+} // namespace
+
+template <typename Output>
+static void writeEscaped(Output &out, const std::string &str) {
+  out.append('"');
+
+  auto data = str.data();
+  auto length = str.length();
+  size_t nextUnprocessed = 0;
+
+  for (auto pos = findStringCandidate(data, 0, length); pos < length;
+       pos = findStringCandidate(data, pos + 1, length)) {
+    auto sequence = escapeSequence(data[pos]);
+    if (sequence != nullptr) {
+      out.appendStored(data + nextUnprocessed, pos - nextUnprocessed);
+      out.append(sequence, 2);
+      nextUnprocessed = pos + 1;
+    }
+  }
+
+  out.appendStored(data + nextUnprocessed, length - nextUnprocessed);
+  out.append('"');
+}
+
+template <typename Output>
+static void writeJsonEscaped(Output &out, const std::string &str) {
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+
+  out.append('"');
+
+  auto data = str.data();
+  auto length = str.length();
+  size_t nextUnprocessed = 0;
+
+  for (auto pos = findStringCandidate(data, 0, length); pos < length;
+       pos = findStringCandidate(data, pos + 1, length)) {
+    auto c = static_cast<uint8_t>(data[pos]);
+    if (c == '\'') {
+      continue;
+    }
+
+    out.appendStored(data + nextUnprocessed, pos - nextUnprocessed);
+    nextUnprocessed = pos + 1;
+
+    auto sequence = escapeSequence(data[pos]);
+    if (sequence != nullptr) {
+      out.append(sequence, 2);
+    } else {
+      char unicode[] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4u],
+                        HEX_DIGITS[c & 0xFu]};
+      out.append(unicode, sizeof(unicode));
+    }
+  }
+
+  out.appendStored(data + nextUnprocessed, length - nextUnprocessed);
+  out.append('"');
+}
+
+template <typename Output>
+static void writeEscapedKey(Output &out, const std::string &str) {
+  if (needsQuotedKey(str)) {
+    writeEscaped(out, str);
+  } else {
+    out.appendStored(str.data(), str.length());
+  }
+}
+
+void internal::appendEscaped(std::string &out, const std::string &str) {
+  StringOutput output(out);
+  writeEscaped(output, str);
+}
+
+void internal::appendJsonEscaped(std::string &out, const std::string &str) {
+  StringOutput output(out);
+  writeJsonEscaped(output, str);
+}
+
+void internal::appendEscapedKey(std::string &out, const std::string &str) {
+  StringOutput output(out);
+  writeEscapedKey(output, str);
+}
+
+template <typename Output> class internal::Serializer {
+  // Chunks of parallel output are formatted by other instantiations
+  template <typename> friend class Serializer;
+
+private:
+  Output &out;
+  const WriterOptions &options;
+
+  void writeScalar(const Value &value) {
+    switch (value.kind) {
+    case Value::Kind::Bool:
+      writeBool(value.nonStrValue.boolValue);
+      break;
+    case Value::Kind::Int:
+      writeInt(value.nonStrValue.intValue);
+      break;
+    case Value::Kind::Float:
+      writeFloat(value.nonStrValue.floatValue);
+      break;
+    case Value::Kind::String:
+      writeString(value.strValue);
+      break;
+    case Value::Kind::Null:
+      writeNull();
+      break;
+    default:
+      unreachable();
+    }
+  }
+
+  // Writes what precedes the item at index of an array whose items are
+  // indented by indent.
+  void beginItem(const std::vector<Value> &items, size_t index,
+                 uint32_t indent) {
+    if (options.format != WriterOptions::Format::Cson) {
+      if (index > 0) {
+        out.append(',');
+      }
+      return;
+    }
+
+    if (index > 0 && items[index - 1].kind == Value::Kind::Object) {
+      writeNewline(indent - 2);
+      out.append(',');
+    }
+
+    writeNewline(indent);
+  }
+
+  // Writes what precedes the value of an object entry whose keys are
+  // indented by indent.
+  void beginEntry(const std::pair<const std::string, Value> &entry,
+                  bool first, uint32_t indent) {
+    if (options.format != WriterOptions::Format::Cson) {
+      if (!first) {
+        out.append(',');
+      }
+
+      if (options.format == WriterOptions::Format::Json) {
+        writeJsonEscaped(out, entry.first);
+      } else {
+        writeEscapedKey(out, entry.first);
+      }
+      out.append(':');
+      return;
+    }
+
+    if (!first) {
+      writeNewline(indent);
+    }
+
+    writeEscapedKey(out, entry.first);
+    out.append(':');
+
+    if (entry.second.kind == Value::Kind::Object) {
+      writeNewline(indent + 2);
+    } else {
+      out.append(' ');
+    }
+  }
+
+  void writeCompactValue(const Value &value) {
+    switch (value.kind) {
+    case Value::Kind::Array: {
+      auto &items = value.nonStrValue.arrayValue->items;
+
+      out.append('[');
+      for (size_t i = 0; i < items.size(); ++i) {
+        beginItem(items, i, 0);
+        writeCompactValue(items[i]);
+      }
+      out.append(']');
+      break;
+    }
+    case Value::Kind::Object: {
+      out.append('{');
+
+      auto first = true;
+      for (auto &entry : value.nonStrValue.objectValue->items) {
+        beginEntry(entry, first, 0);
+        writeCompactValue(entry.second);
+        first = false;
+      }
+
+      out.append('}');
+      break;
+    }
+    default:
+      writeScalar(value);
+      break;
+    }
+
+    out.checkpoint();
+  }
+
+  void writeValue(const Value &value, uint32_t indent, bool topMost) {
+    switch (value.kind) {
+    case Value::Kind::Array: {
+      auto &items = value.nonStrValue.arrayValue->items;
+
+      if (items.empty()) {
+        out.append("[]", 2);
+      } else {
+        out.append('[');
+
+        for (size_t i = 0; i < items.size(); ++i) {
+          beginItem(items, i, indent + 2);
+          // Objects start at the indentation of the array item
+          writeValue(items[i], indent + 2,
+                     items[i].kind == Value::Kind::Object);
+        }
+
+        writeNewline(indent);
+        out.append(']');
+      }
+      break;
+    }
+    case Value::Kind::Object: {
+      if (value.nonStrValue.objectValue->items.empty()) {
+        out.append("{}", 2);
+      } else {
+        if (!topMost) {
+          indent += 2;
+        }
+
+        auto first = true;
+        for (auto &entry : value.nonStrValue.objectValue->items) {
+          beginEntry(entry, first, indent);
+          writeValue(entry.second, indent, false);
+          first = false;
+        }
+      }
+      break;
+    }
+    default:
+      writeScalar(value);
+      break;
+    }
+
+    out.checkpoint();
+  }
+
+  static bool isFilled(const Value &value) {
+    return value.getItemCount() > 0;
+  }
+
+  // Writes a non-empty container like writeValue() and writeCompactValue(),
+  // with its items written by writeItems(indent of the items).
+  template <typename WriteItems>
+  void writeContainer(const Value &value, uint32_t indent, bool topMost,
+                      const WriteItems &writeItems) {
+    auto pretty = options.format == WriterOptions::Format::Cson;
+    auto array = value.kind == Value::Kind::Array;
+
+    if (!pretty) {
+      out.append(array ? '[' : '{');
+    } else if (array) {
+      out.append('[');
+      indent += 2;
+    } else if (!topMost) {
+      indent += 2;
+    }
+
+    writeItems(indent);
+
+    if (!pretty) {
+      out.append(array ? ']' : '}');
+    } else if (array) {
+      writeNewline(indent - 2);
+      out.append(']');
+    }
+
+    out.checkpoint();
+  }
+
+  // Writes what precedes each item of a container and hands the item to
+  // writeItem(item, indent, topMost) to write it at its position.
+  template <typename WriteItem>
+  void writeEachItem(const Value &value, uint32_t indent,
+                     const WriteItem &writeItem) {
+    if (value.kind == Value::Kind::Array) {
+      auto &items = value.nonStrValue.arrayValue->items;
+
+      for (size_t i = 0; i < items.size(); ++i) {
+        beginItem(items, i, indent);
+        writeItem(items[i], indent, items[i].kind == Value::Kind::Object);
+      }
+    } else {
+      auto first = true;
+      for (auto &entry : value.nonStrValue.objectValue->items) {
+        beginEntry(entry, first, indent);
+        writeItem(entry.second, indent, false);
+        first = false;
+      }
+    }
+  }
+
+  // Writes a container into its cache, leaving out nested containers.
+  void writeShallow(const Value &value, uint32_t indent, bool topMost) {
+    writeContainer(value, indent, topMost, [&](uint32_t itemIndent) {
+      writeEachItem(value, itemIndent,
+                    [&](const Value &item, uint32_t indent, bool topMost) {
+                      if (isFilled(item)) {
+                        out.appendChild(item, indent, topMost);
+                      } else {
+                        write(item, indent, topMost);
+                      }
+                    });
+    });
+  }
+
+  // Formats the items or entries of a container in chunks on several threads
+  // and appends the chunks in order.
+  void writeChunks(const Value &value, uint32_t indent, uint32_t threads) {
+    const size_t CHUNKS_PER_THREAD = 4;
+
+    auto count = static_cast<size_t>(value.getItemCount());
+    auto chunkCount = std::min(count, threads * CHUNKS_PER_THREAD);
+
+    // Object chunks start at iterators, which are found in one pass
+    std::vector<std::map<std::string, Value>::const_iterator> entryStarts;
+    if (value.kind == Value::Kind::Object) {
+      auto itr = value.nonStrValue.objectValue->items.begin();
+      for (size_t i = 0; i < count; ++i, ++itr) {
+        if (i == entryStarts.size() * count / chunkCount) {
+          entryStarts.push_back(itr);
+        }
+      }
+      entryStarts.push_back(itr);
+    }
+
+    std::vector<std::string> chunks(chunkCount);
+    std::atomic<size_t> nextChunk(0);
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    auto work = [&]() {
+      try {
+        for (auto chunk = nextChunk++; chunk < chunkCount;
+             chunk = nextChunk++) {
+          StringOutput chunkOut(chunks[chunk]);
+          Serializer<StringOutput> serializer(chunkOut, options);
+
+          if (value.kind == Value::Kind::Array) {
+            auto &items = value.nonStrValue.arrayValue->items;
+
+            for (auto i = chunk * count / chunkCount,
+                      end = (chunk + 1) * count / chunkCount;
+                 i < end; ++i) {
+              serializer.beginItem(items, i, indent);
+              serializer.writeAt(items[i], indent,
+                                   items[i].kind == Value::Kind::Object);
+            }
+          } else {
+            for (auto itr = entryStarts[chunk]; itr != entryStarts[chunk + 1];
+                 ++itr) {
+              serializer.beginEntry(*itr, itr == entryStarts.front(), indent);
+              serializer.writeAt(itr->second, indent, false);
+            }
+          }
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        error = std::current_exception();
+      }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (uint32_t i = 1; i < threads; ++i) {
+      try {
+        workers.emplace_back(work);
+      } catch (const std::system_error &) {
+        // The chunks are claimed by the threads that did start
+        break;
+      }
+    }
+    work();
+
+    for (auto &worker : workers) {
+      worker.join();
+    }
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    for (auto &chunk : chunks) {
+      out.append(chunk.data(), chunk.length());
+      out.checkpoint();
+    }
+  }
+
+public:
+  void writeBool(bool value) {
+    if (value) {
+      out.append("true", 4);
+    } else {
+      out.append("false", 5);
+    }
+  }
+
+  void writeInt(int64_t value) {
+    char buffer[MAX_NUMBER_LENGTH];
+    out.append(buffer, formatInt(buffer, value));
+  }
+
+  void writeFloat(double value) {
+    if (options.format == WriterOptions::Format::Json &&
+        !std::isfinite(value)) {
+      // JSON has no representation for NaN and infinity
+      out.append("null", 4);
+    } else {
+      char buffer[MAX_NUMBER_LENGTH];
+      out.append(buffer, formatFloat(buffer, value));
+    }
+  }
+
+  void writeString(const std::string &value) {
+    if (options.format == WriterOptions::Format::Json) {
+      writeJsonEscaped(out, value);
+    } else {
+      writeEscaped(out, value);
+    }
+  }
+
+  void writeNull() { out.append("null", 4); }
+
+  explicit Serializer(Output &out, const WriterOptions &options)
+      : out(out), options(options) {}
+
+  void writeNewline(uint32_t indent) {
+    if (indent <= MAX_NEWLINE_INDENT) {
+      out.append(NEWLINE_INDENT, indent + 1);
+      return;
+    }
+
+    out.append(NEWLINE_INDENT, MAX_NEWLINE_INDENT + 1);
+    indent -= MAX_NEWLINE_INDENT;
+
+    while (indent > MAX_NEWLINE_INDENT) {
+      out.append(NEWLINE_INDENT + 1, MAX_NEWLINE_INDENT);
+      indent -= MAX_NEWLINE_INDENT;
+    }
+
+    out.append(NEWLINE_INDENT + 1, indent);
+  }
+
+  // Writes value at the given position of a pretty printed document. The
+  // position is ignored by the compact formats.
+  void write(const Value &value, uint32_t indent, bool topMost) {
+    if (options.format == WriterOptions::Format::Cson) {
+      writeValue(value, indent, topMost);
+    } else {
+      writeCompactValue(value);
+    }
+  }
+
+  void write(const Value &value) { write(value, 0, true); }
+
+  // Like write(), but uses the caches if enabled.
+  void writeAt(const Value &value, uint32_t indent, bool topMost) {
+    if (options.cache) {
+      writeCached(value, indent, topMost);
+    } else {
+      write(value, indent, topMost);
+    }
+  }
+
+  // Writes the same output as write(). Containers with enough items are
+  // formatted on several threads, smaller ones are descended into so large
+  // nested containers are found.
+  void writeParallel(const Value &value, uint32_t indent, bool topMost,
+                     uint32_t threads) {
+    const size_t MIN_PARALLEL_ITEMS = 64;
+
+    if (!isFilled(value)) {
+      write(value, indent, topMost);
+      return;
+    }
+
+    writeContainer(value, indent, topMost, [&](uint32_t itemIndent) {
+      if (value.getItemCount() >=
+          std::max(MIN_PARALLEL_ITEMS, static_cast<size_t>(threads))) {
+        writeChunks(value, itemIndent, threads);
+      } else {
+        writeEachItem(value, itemIndent,
+                      [&](const Value &item, uint32_t indent, bool topMost) {
+                        writeParallel(item, indent, topMost, threads);
+                      });
+      }
+    });
+  }
+
+  std::unique_ptr<SerializationCache> buildCache(const Value &value,
+                                                 uint32_t indent,
+                                                 bool topMost) const {
+    std::unique_ptr<SerializationCache> cache(new SerializationCache());
+    cache->format = options.format;
+    cache->indent = indent;
+    cache->topMost = topMost;
+
+    CacheOutput cacheOut(*cache);
+    Serializer<CacheOutput>(cacheOut, options)
+        .writeShallow(value, indent, topMost);
+    return cache;
+  }
+
+  const SerializationCache *findCache(const SerializationCache *cache) const {
+    while (cache != nullptr && cache->format != options.format) {
+      cache = cache->next;
+    }
+    return cache;
+  }
+
+  // Text of a cache that is not stored in the value is copied, as it is freed
+  // before outputs referencing stored text are done.
+  void appendCache(const SerializationCache &cache, bool stored) {
+    size_t pos = 0;
+    for (auto &child : cache.children) {
+      if (stored) {
+        out.appendStored(cache.text.data() + pos, child.offset - pos);
+      } else {
+        out.append(cache.text.data() + pos, child.offset - pos);
+      }
+      writeCached(*child.value, child.indent, child.topMost);
+      pos = child.offset;
+    }
+
+    if (stored) {
+      out.appendStored(cache.text.data() + pos, cache.text.length() - pos);
+    } else {
+      out.append(cache.text.data() + pos, cache.text.length() - pos);
+    }
+    out.checkpoint();
+  }
+
+  // Writes the same output as write(), reusing and filling the caches of
+  // containers. A container keeps one cache per format, of the first position
+  // it is written at, as other threads may be reading it. Other positions are
+  // formatted again on every write.
+  void writeCached(const Value &value, uint32_t indent, bool topMost) {
+    if (!isFilled(value)) {
+      write(value, indent, topMost);
+      return;
+    }
+
+    if (options.format != WriterOptions::Format::Cson) {
+      indent = 0;
+      topMost = true;
+    }
+
+    auto head = value.cache.load();
+    auto cache = findCache(head);
+
+    if (cache == nullptr) {
+      auto built = buildCache(value, indent, topMost);
+      built->next = head;
+      while (!value.cache.compare_exchange_weak(head, built.get())) {
+        // Another thread may have published this format meanwhile
+        cache = findCache(head);
+        if (cache != nullptr) {
+          built->next = nullptr;
+          break;
+        }
+        built->next = head;
+      }
+
+      if (cache == nullptr) {
+        cache = built.release();
+      }
+    }
+
+    if (cache->indent == indent && cache->topMost == topMost) {
+      appendCache(*cache, true);
+    } else {
+      appendCache(*buildCache(value, indent, topMost), false);
+    }
+  }
+
+  // Writes a whole document according to the options.
+  void writeDocument(const Value &value) {
+    if (options.threads > 1) {
+      writeParallel(value, 0, true, options.threads);
+    } else {
+      writeAt(value, 0, true);
+    }
+  }
+};
+
+const WriterOptions DEFAULT_WRITER_OPTIONS = {WriterOptions::Format::Cson, 0,
+                                              false};
+
+Writer::Writer(std::string &output, const WriterOptions &options)
+    : options(options), output(&output),
+      flushThreshold(std::numeric_limits<size_t>::max()) {}
+
+Writer::Writer(const Sink &sink, size_t bufferSize,
+               const WriterOptions &options)
+    : options(options), sink(sink), output(&buffer),
+      flushThreshold(bufferSize != 0 ? bufferSize : DEFAULT_BUFFER_SIZE) {
+  buffer.reserve(flushThreshold + MAX_NEWLINE_INDENT + 1);
+}
+
+void Writer::write(const Value &value) {
+  WriterOutput out(*output, flushThreshold, *this);
+  internal::Serializer<WriterOutput>(out, options).writeDocument(value);
+}
+
+void Writer::flush() {
+  if (sink && !buffer.empty()) {
+    sink(buffer.data(), buffer.length());
+    buffer.clear();
+  }
+}
+
+void print(std::ostream &stream, const Value &value,
+           const WriterOptions &options) {
+  Writer writer(
+      [&stream](const char *data, size_t length) {
+        stream.write(data, static_cast<std::streamsize>(length));
+      },
+      Writer::DEFAULT_BUFFER_SIZE, options);
+
+  writer.write(value);
+  writer.flush();
+}
+
+Emitter::Emitter(std::string &output, const WriterOptions &options)
+    : writer(output, options), hasKey(false), complete(false) {}
+
+Emitter::Emitter(const Writer::Sink &sink, size_t bufferSize,
+                 const WriterOptions &options)
+    : writer(sink, bufferSize, options), hasKey(false), complete(false) {}
+
+void Emitter::beginValue(bool object, uint32_t &indent, bool &topMost) {
+  WriterOutput out(*writer.output, writer.flushThreshold, writer);
+  internal::Serializer<WriterOutput> serializer(out, writer.options);
+  auto pretty = writer.options.format == WriterOptions::Format::Cson;
+
+  if (frames.empty()) {
+    if (complete) {
+      throw EmitterError("The document is already complete");
+    }
+
+    indent = 0;
+    topMost = true;
+    return;
+  }
+
+  auto &frame = frames.back();
+  indent = frame.indent;
+
+  if (frame.object) {
+    if (!hasKey) {
+      throw EmitterError("Expected a key before the value");
+    }
+    hasKey = false;
+
+    if (pretty) {
+      // See Serializer::writeValue()
+      if (object) {
+        serializer.writeNewline(indent + 2);
+      } else {
+        out.append(' ');
+      }
+    }
+
+    topMost = false;
+    return;
+  }
+
+  // See Serializer::writeItems()
+  if (pretty) {
+    if (!frame.empty && frame.lastWasObject) {
+      serializer.writeNewline(indent - 2);
+      out.append(',');
+    }
+
+    serializer.writeNewline(indent);
+  } else if (!frame.empty) {
+    out.append(',');
+  }
+
+  frame.empty = false;
+  frame.lastWasObject = object;
+  topMost = object;
+}
+
+void Emitter::endValue() {
+  if (frames.empty()) {
+    complete = true;
+  }
+
+  WriterOutput(*writer.output, writer.flushThreshold, writer).checkpoint();
+}
+
+Emitter::Frame &Emitter::endContainer(bool object) {
+  if (frames.empty() || frames.back().object != object) {
+    throw EmitterError(object ? "No object to end" : "No array to end");
+  }
+
+  if (hasKey) {
+    throw EmitterError("Expected a value after the key");
+  }
+
+  return frames.back();
+}
+
+void Emitter::beginObject() {
+  uint32_t indent;
+  bool topMost;
+  beginValue(true, indent, topMost);
+
+  if (writer.options.format != WriterOptions::Format::Cson) {
+    *writer.output += '{';
+  }
+
+  frames.push_back({true, true, false, topMost ? indent : indent + 2});
+}
+
+void Emitter::endObject() {
+  auto &frame = endContainer(true);
+
+  if (writer.options.format != WriterOptions::Format::Cson) {
+    *writer.output += '}';
+  } else if (frame.empty) {
+    writer.output->append("{}", 2);
+  }
+
+  frames.pop_back();
+  endValue();
+}
+
+void Emitter::beginArray() {
+  uint32_t indent;
+  bool topMost;
+  beginValue(false, indent, topMost);
+
+  *writer.output += '[';
+  frames.push_back({false, true, false, indent + 2});
+}
+
+void Emitter::endArray() {
+  auto &frame = endContainer(false);
+
+  if (writer.options.format == WriterOptions::Format::Cson && !frame.empty) {
+    WriterOutput out(*writer.output, writer.flushThreshold, writer);
+    internal::Serializer<WriterOutput>(out, writer.options)
+        .writeNewline(frame.indent - 2);
+  }
+  *writer.output += ']';
+
+  frames.pop_back();
+  endValue();
+}
+
+void Emitter::key(const std::string &key) {
+  if (frames.empty() || !frames.back().object || hasKey) {
+    throw EmitterError("Unexpected key " + key);
+  }
+
+  WriterOutput out(*writer.output, writer.flushThreshold, writer);
+  auto &frame = frames.back();
+
+  if (!frame.empty) {
+    if (writer.options.format == WriterOptions::Format::Cson) {
+      internal::Serializer<WriterOutput>(out, writer.options)
+          .writeNewline(frame.indent);
+    } else {
+      out.append(',');
+    }
+  }
+
+  if (writer.options.format == WriterOptions::Format::Json) {
+    writeJsonEscaped(out, key);
+  } else {
+    writeEscapedKey(out, key);
+  }
+  out.append(':');
+
+  frame.empty = false;
+  hasKey = true;
+}
+
+void Emitter::value(const Value &value) {
+  uint32_t indent;
+  bool topMost;
+  beginValue(value.isObject(), indent, topMost);
+
+  WriterOutput out(*writer.output, writer.flushThreshold, writer);
+  internal::Serializer<WriterOutput>(out, writer.options)
+      .writeAt(value, indent, topMost);
+
+  endValue();
+}
+
+template <typename Write> void Emitter::scalar(const Write &write) {
+  uint32_t indent;
+  bool topMost;
+  beginValue(false, indent, topMost);
+
+  WriterOutput out(*writer.output, writer.flushThreshold, writer);
+  internal::Serializer<WriterOutput> serializer(out, writer.options);
+  write(serializer);
+
+  endValue();
+}
+
+void Emitter::nullValue() {
+  scalar([](internal::Serializer<WriterOutput> &serializer) {
+    serializer.writeNull();
+  });
+}
+
+void Emitter::boolValue(bool value) {
+  scalar([value](internal::Serializer<WriterOutput> &serializer) {
+    serializer.writeBool(value);
+  });
+}
+
+void Emitter::intValue(int64_t value) {
+  scalar([value](internal::Serializer<WriterOutput> &serializer) {
+    serializer.writeInt(value);
+  });
+}
+
+void Emitter::floatValue(double value) {
+  scalar([value](internal::Serializer<WriterOutput> &serializer) {
+    serializer.writeFloat(value);
+  });
+}
+
+void Emitter::stringValue(const std::string &value) {
+  scalar([&value](internal::Serializer<WriterOutput> &serializer) {
+    serializer.writeString(value);
+  });
+}
+
+void Emitter::flush() { writer.flush(); }
+
+size_t serializedSize(const Value &value, const WriterOptions &options) {
+  CountingOutput out;
+  internal::Serializer<CountingOutput>(out, options).writeDocument(value);
+  return out.length;
+}
+
+size_t serializeInto(char *buffer, size_t size, const Value &value,
+                     const WriterOptions &options) {
+  FixedOutput out(buffer, size);
+  internal::Serializer<FixedOutput>(out, options).writeDocument(value);
+  return static_cast<size_t>(out.pos - buffer);
+}
+
+void serializeFragments(const Value &value, std::string &storage,
+                        std::vector<Fragment> &fragments,
+                        const WriterOptions &options,
+                        size_t minReferenceLength) {
+  FragmentOutput out(storage, minReferenceLength);
+  internal::Serializer<FragmentOutput>(out, options).writeDocument(value);
+  out.finish(fragments);
+}
+
+std::string escapeKey(const std::string &str) {
+  std::string result;
+  result.reserve(str.length());
+  internal::appendEscapedKey(result, str);
+  return result;
+}
+
+std::string escape(const std::string &str) {
+  std::string result;
+  result.reserve(2 + str.length());
+  internal::appendEscaped(result, str);
+  return result;
+}
+
+} // namespace cppcson
@@ -1,6 +1,34 @@
 #include "cppcson.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <sstream>
+#include <system_error>
+#include <unordered_set>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static std::atomic<uint64_t> allocationCount(0);
+
+void *operator new(size_t size) {
+  ++allocationCount;
+
+  auto ptr = std::malloc(size != 0 ? size : 1);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
 
 TEST(Null, keyword) {
   std::istringstream stream("null");
@@ -821,3 +849,1791 @@ TEST(Print, objectNested) {
 
   EXPECT_EQ("a:\n  b: 2\nc: 3", stream.str());
 }
+
+TEST(ReadAhead, parse) {
+  std::string str = "[";
+  for (auto i = 0; i < 1000; ++i) {
+    str += "\n  \"item " + std::to_string(i) + "\"";
+  }
+  str += "\n]";
+
+  std::istringstream expectedStream(str);
+  auto expected = cppcson::parse(expectedStream);
+
+  cppcson::Options options = cppcson::DEFAULT_OPTIONS;
+  options.readAheadBuffers = 3;
+  options.readAheadBufferSize = 7;
+
+  std::istringstream stream(str);
+  auto root = cppcson::parse(stream, options);
+
+  EXPECT_EQ(1000, root.getItemCount());
+  EXPECT_EQ(expected, root);
+  EXPECT_EQ(expected.item(999).getLocation(), root.item(999).getLocation());
+}
+
+TEST(ReadAhead, sourceError) {
+  auto calls = 0;
+  cppcson::ReadAheadBuffer buffer(
+      [&calls](char *data, size_t size) -> size_t {
+        if (++calls > 1) {
+          throw std::runtime_error("read failed");
+        }
+
+        std::fill(data, data + size, ' ');
+        return size;
+      },
+      2, 16);
+  std::istream stream(&buffer);
+  stream.exceptions(std::ios::badbit);
+
+  EXPECT_THROW(cppcson::parse(stream), std::runtime_error);
+}
+
+#ifdef CPPCSON_WITH_ZLIB
+#include <zlib.h>
+
+static std::string gzip(const std::string &str) {
+  z_stream zStream{};
+  deflateInit2(&zStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+               Z_DEFAULT_STRATEGY);
+
+  std::string result(deflateBound(&zStream, static_cast<uLong>(str.size())),
+                     '\0');
+  zStream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(str.data()));
+  zStream.avail_in = static_cast<uInt>(str.size());
+  zStream.next_out = reinterpret_cast<Bytef *>(&result[0]);
+  zStream.avail_out = static_cast<uInt>(result.size());
+  deflate(&zStream, Z_FINISH);
+  result.resize(zStream.total_out);
+  deflateEnd(&zStream);
+
+  return result;
+}
+
+TEST(Gzip, parse) {
+  std::string str = "a: 1\nb: [\n  'x'\n  'y'\n]";
+  for (auto i = 0; i < 1000; ++i) {
+    str += "\nkey" + std::to_string(i) + ": " + std::to_string(i);
+  }
+
+  std::istringstream expectedStream(str);
+  auto expected = cppcson::parse(expectedStream);
+
+  cppcson::Options options = cppcson::DEFAULT_OPTIONS;
+  options.readAheadBufferSize = 100;
+
+  std::istringstream stream(gzip(str) + gzip("\nc: null"));
+  auto root = cppcson::parseGzip(stream, options);
+
+  EXPECT_EQ(1003, root.getItemCount());
+  EXPECT_EQ(expected.item("key999"), root.item("key999"));
+  EXPECT_TRUE(root.item("c").isNull());
+}
+
+TEST(Gzip, truncated) {
+  auto data = gzip("a: 1\nb: 2");
+  std::istringstream stream(data.substr(0, data.size() - 12));
+
+  EXPECT_THROW(cppcson::parseGzip(stream), cppcson::CompressionError);
+}
+#endif
+
+TEST(Limits, cancelled) {
+  std::string str(10000, ' ');
+  str += "null";
+  std::atomic<bool> cancelled(true);
+
+  cppcson::Options options = cppcson::DEFAULT_OPTIONS;
+  options.cancelled = &cancelled;
+
+  std::istringstream stream(str);
+  EXPECT_THROW(cppcson::parse(stream, options), cppcson::CancelledError);
+}
+
+TEST(Limits, progress) {
+  std::string str(1000, ' ');
+  str += "null";
+  std::vector<uint64_t> calls;
+
+  cppcson::Options options = cppcson::DEFAULT_OPTIONS;
+  options.progress = [&calls](uint64_t bytes) { calls.push_back(bytes); };
+  options.progressInterval = 300;
+
+  std::istringstream stream(str);
+  cppcson::parse(stream, options);
+
+  EXPECT_EQ(std::vector<uint64_t>({300, 600, 900}), calls);
+}
+
+TEST(Limits, maxBytes) {
+  cppcson::Options options = cppcson::DEFAULT_OPTIONS;
+  options.maxBytes = 8;
+
+  std::istringstream stream("[1, 2, 3]");
+  EXPECT_THROW(cppcson::parse(stream, options), cppcson::LimitExceededError);
+
+  std::istringstream stream2("[1, 2]");
+  EXPECT_EQ(2, cppcson::parse(stream2, options).getItemCount());
+}
+
+TEST(Limits, maxStringLength) {
+  cppcson::Options options = cppcson::DEFAULT_OPTIONS;
+  options.maxStringLength = 3;
+
+  std::istringstream stream("'abcd'");
+  EXPECT_THROW(cppcson::parse(stream, options), cppcson::LimitExceededError);
+
+  std::istringstream stream2("abcd: 1");
+  EXPECT_THROW(cppcson::parse(stream2, options), cppcson::LimitExceededError);
+
+  std::istringstream stream3("'abc'");
+  EXPECT_EQ("abc", cppcson::parse(stream3, options).asString());
+}
+
+TEST(Limits, maxItems) {
+  cppcson::Options options = cppcson::DEFAULT_OPTIONS;
+  options.maxItems = 2;
+
+  std::istringstream stream("[1, 2, 3]");
+  EXPECT_THROW(cppcson::parse(stream, options), cppcson::LimitExceededError);
+
+  std::istringstream stream2("a: 1\nb: 2\nc: 3");
+  EXPECT_THROW(cppcson::parse(stream2, options), cppcson::LimitExceededError);
+}
+
+TEST(Limits, maxNodes) {
+  cppcson::Options options = cppcson::DEFAULT_OPTIONS;
+  options.maxNodes = 3;
+
+  std::istringstream stream("[1, [2, 3]]");
+  EXPECT_THROW(cppcson::parse(stream, options), cppcson::LimitExceededError);
+
+  std::istringstream stream2("[1, 2]");
+  EXPECT_EQ(2, cppcson::parse(stream2, options).getItemCount());
+}
+
+TEST(ParserContext, reuse) {
+  cppcson::ParserContext context;
+
+  std::istringstream stream("a: [1, [2, 'three']]\nb: 'four'");
+  auto first = context.parse(stream);
+
+  std::istringstream invalidStream("[1, [2, 'three");
+  EXPECT_THROW(context.parse(invalidStream), cppcson::SyntaxError);
+
+  std::istringstream stream2("a: [1, [2, 'three']]\nb: 'four'");
+  auto second = context.parse(stream2);
+
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(".a[1][1]", second.item("a").item(1).item(1).getPath());
+  EXPECT_EQ("three", second.item("a").item(1).item(1).asString());
+}
+
+TEST(Allocations, stringLiteral) {
+  std::string text(100, 'x');
+  std::string str = "'" + text + "'";
+  cppcson::ParserContext context;
+
+  std::istringstream warmUpStream(str);
+  context.parse(warmUpStream);
+
+  std::istringstream stream(str);
+  auto before = allocationCount.load();
+  auto root = context.parse(stream);
+  auto after = allocationCount.load();
+
+  EXPECT_EQ(text, root.asString());
+  EXPECT_EQ(1, after - before);
+}
+
+TEST(Allocations, arrayOfStrings) {
+  std::string text(100, 'x');
+  std::string str = "['" + text + "', '" + text + "', '" + text + "']";
+  cppcson::ParserContext context;
+
+  std::istringstream warmUpStream(str);
+  context.parse(warmUpStream);
+
+  std::istringstream stream(str);
+  auto before = allocationCount.load();
+  auto root = context.parse(stream);
+  auto after = allocationCount.load();
+
+  EXPECT_EQ(text, root.item(2).asString());
+  // One allocation per string plus the shared items and their storage
+  EXPECT_EQ(5, after - before);
+}
+
+TEST(Print, arrayObjectMultipleKeys) {
+  std::istringstream stream("[{a: 1, b: 2}, {c: {x: 1, y: 2}}, 3]");
+  auto value = cppcson::parse(stream);
+
+  std::ostringstream printStream;
+  cppcson::print(printStream, value);
+
+  EXPECT_EQ("[\n  a: 1\n  b: 2\n,\n  c:\n    x: 1\n    y: 2\n,\n  3\n]",
+            printStream.str());
+
+  std::istringstream reparseStream(printStream.str());
+  EXPECT_EQ(value, cppcson::parse(reparseStream));
+}
+
+TEST(Writer, buffer) {
+  auto value = cppcson::Value::newObject();
+  value.add("a b", cppcson::Value::newString("x\ty"));
+  value.add("c", cppcson::Value::newInt(std::numeric_limits<int64_t>::min()));
+
+  std::string output = "prefix ";
+  cppcson::Writer writer(output);
+  writer.write(value);
+
+  EXPECT_EQ("prefix \"a b\": \"x\\ty\"\nc: -9223372036854775808", output);
+}
+
+TEST(Writer, sink) {
+  auto value = cppcson::Value::newArray();
+  for (auto i = 0; i < 1000; ++i) {
+    value.add(cppcson::Value::newInt(i * 997));
+  }
+
+  std::ostringstream expected;
+  cppcson::print(expected, value);
+
+  std::string output;
+  auto calls = 0;
+  cppcson::Writer writer(
+      [&output, &calls](const char *data, size_t length) {
+        output.append(data, length);
+        ++calls;
+      },
+      64);
+  writer.write(value);
+  writer.flush();
+
+  EXPECT_EQ(expected.str(), output);
+  EXPECT_LT(10, calls);
+}
+
+TEST(Writer, deepIndent) {
+  auto value = cppcson::Value::newInt(1);
+  for (auto i = 0; i < 100; ++i) {
+    auto array = cppcson::Value::newArray();
+    array.add(std::move(value));
+    value = std::move(array);
+  }
+
+  std::string output;
+  cppcson::Writer writer(output);
+  writer.write(value);
+
+  auto indent = std::string(200, ' ');
+  EXPECT_NE(std::string::npos, output.find("\n" + indent + "1\n"));
+
+  std::istringstream stream(output);
+  EXPECT_EQ(value, cppcson::parse(stream));
+}
+
+TEST(Print, floatRoundTrip) {
+  auto value = cppcson::Value::newArray();
+  for (auto number : {0.1, 1.0, -2.5e-8, 1e21, 123456.789, 5e-324,
+                      1.7976931348623157e308, 0.30000000000000004}) {
+    value.add(cppcson::Value::newFloat(number));
+  }
+
+  std::ostringstream stream;
+  cppcson::print(stream, value);
+
+  EXPECT_EQ("[\n  0.1\n  1.0\n  -2.5e-08\n  1e+21\n  123456.789\n  5e-324\n"
+            "  1.7976931348623157e+308\n  0.30000000000000004\n]",
+            stream.str());
+
+  std::istringstream reparseStream(stream.str());
+  EXPECT_EQ(value, cppcson::parse(reparseStream));
+}
+
+TEST(Print, operatorFloat) {
+  auto value = cppcson::Value::newArray();
+  value.add(cppcson::Value::newFloat(0.1));
+  value.add(cppcson::Value::newInt(-42));
+
+  std::ostringstream stream;
+  stream << value;
+
+  EXPECT_EQ("[0.1, -42]", stream.str());
+}
+
+TEST(Print, compactCson) {
+  std::istringstream stream("a: [1, 'x y', {}]\n'b c':\n  d: null\ne: []");
+  auto value = cppcson::parse(stream);
+
+  std::ostringstream printStream;
+  cppcson::print(printStream, value,
+                 {cppcson::WriterOptions::Format::CompactCson});
+
+  EXPECT_EQ("{a:[1,\"x y\",{}],\"b c\":{d:null},e:[]}", printStream.str());
+
+  std::istringstream reparseStream(printStream.str());
+  EXPECT_EQ(value, cppcson::parse(reparseStream));
+}
+
+TEST(Print, json) {
+  auto value = cppcson::Value::newObject();
+  value.add("a", cppcson::Value::newString("it's\x01\n"));
+  value.add("b", cppcson::Value::newFloat(
+                     std::numeric_limits<double>::quiet_NaN()));
+  value.add("c", cppcson::Value::newArray());
+
+  std::ostringstream stream;
+  cppcson::print(stream, value, {cppcson::WriterOptions::Format::Json});
+
+  EXPECT_EQ("{\"a\":\"it's\\u0001\\n\",\"b\":null,\"c\":[]}", stream.str());
+}
+
+static cppcson::Value serializationItem() {
+  auto item = cppcson::Value::newObject();
+  item.add("name", cppcson::Value::newString(std::string(100, 'x') + "\n"));
+  item.add("count", cppcson::Value::newInt(-42));
+  return item;
+}
+
+static cppcson::Value serializationSample() {
+  auto array = cppcson::Value::newArray();
+  array.add(serializationItem());
+  array.add(cppcson::Value::newFloat(0.1));
+  array.add(cppcson::Value::newNull());
+
+  auto value = cppcson::Value::newObject();
+  value.add("items", std::move(array));
+  value.add("nested", serializationItem());
+  value.add("flag", cppcson::Value::newBool(true));
+  return value;
+}
+
+TEST(Serialize, exactSize) {
+  auto value = serializationSample();
+
+  for (auto format : {cppcson::WriterOptions::Format::Cson,
+                      cppcson::WriterOptions::Format::CompactCson,
+                      cppcson::WriterOptions::Format::Json}) {
+    std::ostringstream stream;
+    cppcson::print(stream, value, {format});
+    auto expected = stream.str();
+
+    auto size = cppcson::serializedSize(value, {format});
+    EXPECT_EQ(expected.length(), size);
+
+    std::vector<char> buffer(size);
+    EXPECT_EQ(size,
+              cppcson::serializeInto(buffer.data(), size, value, {format}));
+    EXPECT_EQ(expected, std::string(buffer.data(), size));
+
+    EXPECT_THROW(
+        cppcson::serializeInto(buffer.data(), size - 1, value, {format}),
+        std::length_error);
+  }
+}
+
+TEST(Serialize, fragments) {
+  auto value = serializationSample();
+
+  std::ostringstream stream;
+  cppcson::print(stream, value);
+
+  std::string storage;
+  std::vector<cppcson::Fragment> fragments;
+  cppcson::serializeFragments(value, storage, fragments);
+
+  std::string joined;
+  auto referenced = 0;
+  for (auto &fragment : fragments) {
+    auto data = static_cast<const char *>(fragment.data);
+    if (data < storage.data() || data >= storage.data() + storage.length()) {
+      ++referenced;
+    }
+    joined.append(data, fragment.length);
+  }
+
+  EXPECT_EQ(stream.str(), joined);
+  // The long string is stored twice in the sample and referenced both times
+  EXPECT_EQ(2, referenced);
+  EXPECT_EQ(joined.length() - 200, storage.length());
+
+  // Caches of other formats and positions must not be referenced once freed
+  std::ostringstream cachedStream;
+  cppcson::print(cachedStream, value,
+                 {cppcson::WriterOptions::Format::Cson, 0, true});
+  auto wrapper = cppcson::Value::newArray();
+  wrapper.add(value.clone());
+
+  for (auto format : {cppcson::WriterOptions::Format::Json,
+                      cppcson::WriterOptions::Format::Cson}) {
+    for (auto root : {&value, &wrapper}) {
+      std::ostringstream expected;
+      cppcson::print(expected, *root, {format});
+
+      storage.clear();
+      fragments.clear();
+      cppcson::serializeFragments(*root, storage, fragments,
+                                  {format, 0, true});
+
+      joined.clear();
+      for (auto &fragment : fragments) {
+        joined.append(static_cast<const char *>(fragment.data),
+                      fragment.length);
+      }
+      EXPECT_EQ(expected.str(), joined);
+    }
+  }
+}
+
+TEST(Escape, vectorized) {
+  // Every escaped character at every position of strings spanning several
+  // vector chunks
+  const std::string specials = "\"'\b\f\n\r\t\\\x01 .[]{},";
+
+  for (size_t length = 1; length < 40; ++length) {
+    for (size_t pos = 0; pos < length; ++pos) {
+      for (auto special : specials) {
+        std::string str(length, 'a');
+        str[pos] = special;
+
+        std::string expected = "\"";
+        for (auto c : str) {
+          switch (c) {
+          case '"':
+            expected += "\\\"";
+            break;
+          case '\'':
+            expected += "\\'";
+            break;
+          case '\b':
+            expected += "\\b";
+            break;
+          case '\f':
+            expected += "\\f";
+            break;
+          case '\n':
+            expected += "\\n";
+            break;
+          case '\r':
+            expected += "\\r";
+            break;
+          case '\t':
+            expected += "\\t";
+            break;
+          case '\\':
+            expected += "\\\\";
+            break;
+          default:
+            expected += c;
+            break;
+          }
+        }
+        expected += '"';
+
+        EXPECT_EQ(expected, cppcson::escape(str));
+        auto unquoted = special == '\x01' || special == '\b' ||
+                        special == '\f';
+        EXPECT_EQ(unquoted ? str : expected, cppcson::escapeKey(str));
+      }
+    }
+  }
+
+  EXPECT_EQ("a-b#c\xc3\xa4", cppcson::escapeKey("a-b#c\xc3\xa4"));
+  EXPECT_EQ("\"\"", cppcson::escapeKey(""));
+  EXPECT_EQ("\"\xc3\xa4\"", cppcson::escape("\xc3\xa4"));
+}
+
+static void emitTree(cppcson::Emitter &emitter, const cppcson::Value &value) {
+  if (value.isObject()) {
+    emitter.beginObject();
+    for (auto &key : value.keys()) {
+      emitter.key(key);
+      emitTree(emitter, value.item(key));
+    }
+    emitter.endObject();
+  } else if (value.isArray()) {
+    emitter.beginArray();
+    for (auto &item : value) {
+      emitTree(emitter, item);
+    }
+    emitter.endArray();
+  } else {
+    emitter.value(value);
+  }
+}
+
+TEST(Emitter, matchesPrint) {
+  std::istringstream stream(
+      "a: [{b: 1, c: 'x'}, {d: {}}, [1, [], {}], {e: {f: [true, null]}}]\n"
+      "g: {}\n"
+      "h: {i: 1.5, 'j k': []}");
+  auto value = cppcson::parse(stream);
+
+  for (auto format : {cppcson::WriterOptions::Format::Cson,
+                      cppcson::WriterOptions::Format::CompactCson,
+                      cppcson::WriterOptions::Format::Json}) {
+    std::ostringstream printStream;
+    cppcson::print(printStream, value, {format});
+
+    std::string output;
+    cppcson::Emitter emitter(output, {format});
+    emitTree(emitter, value);
+    EXPECT_EQ(printStream.str(), output);
+
+    // Subtrees written as values are formatted the same way
+    std::string subtreeOutput;
+    cppcson::Emitter subtreeEmitter(subtreeOutput, {format});
+    subtreeEmitter.beginObject();
+    for (auto &key : value.keys()) {
+      subtreeEmitter.key(key);
+      subtreeEmitter.value(value.item(key));
+    }
+    subtreeEmitter.endObject();
+    EXPECT_EQ(printStream.str(), subtreeOutput);
+  }
+}
+
+TEST(Emitter, sink) {
+  std::string output;
+  cppcson::Emitter emitter(
+      [&output](const char *data, size_t length) {
+        output.append(data, length);
+      },
+      16);
+
+  emitter.beginArray();
+  for (auto i = 0; i < 100; ++i) {
+    emitter.value(cppcson::Value::newInt(i));
+  }
+  emitter.endArray();
+  emitter.flush();
+
+  std::istringstream stream(output);
+  auto value = cppcson::parse(stream);
+  ASSERT_EQ(100, value.getItemCount());
+  EXPECT_EQ(99, value.item(99).asInt());
+}
+
+TEST(Emitter, misuse) {
+  std::string output;
+  cppcson::Emitter emitter(output);
+
+  EXPECT_THROW(emitter.key("a"), cppcson::EmitterError);
+  EXPECT_THROW(emitter.endObject(), cppcson::EmitterError);
+
+  emitter.beginObject();
+  EXPECT_THROW(emitter.value(cppcson::Value::newNull()),
+               cppcson::EmitterError);
+  EXPECT_THROW(emitter.endArray(), cppcson::EmitterError);
+  emitter.key("a");
+  EXPECT_THROW(emitter.key("b"), cppcson::EmitterError);
+  EXPECT_THROW(emitter.endObject(), cppcson::EmitterError);
+  emitter.value(cppcson::Value::newNull());
+  emitter.endObject();
+
+  EXPECT_THROW(emitter.beginArray(), cppcson::EmitterError);
+  EXPECT_EQ("a: null", output);
+}
+
+TEST(Writer, parallel) {
+  auto makeObject = [](int i) {
+    auto object = cppcson::Value::newObject();
+    object.add("id", cppcson::Value::newInt(i));
+    object.add("name", cppcson::Value::newString("item " + std::to_string(i)));
+    auto tags = cppcson::Value::newArray();
+    for (auto j = 0; j < i % 3; ++j) {
+      tags.add(cppcson::Value::newObject());
+    }
+    object.add("tags", std::move(tags));
+    return object;
+  };
+
+  // Large containers at the root, nested below small ones and inside objects
+  auto items = cppcson::Value::newArray();
+  auto byName = cppcson::Value::newObject();
+  for (auto i = 0; i < 1000; ++i) {
+    items.add(i % 2 == 0 ? makeObject(i) : cppcson::Value::newFloat(i / 8.0));
+    byName.add("key" + std::to_string(i), makeObject(i));
+  }
+
+  auto root = cppcson::Value::newObject();
+  root.add("items", std::move(items));
+  auto wrapper = cppcson::Value::newArray();
+  wrapper.add(std::move(byName));
+  wrapper.add(cppcson::Value::newObject());
+  root.add("wrapped", std::move(wrapper));
+
+  for (auto format : {cppcson::WriterOptions::Format::Cson,
+                      cppcson::WriterOptions::Format::CompactCson,
+                      cppcson::WriterOptions::Format::Json}) {
+    std::ostringstream expected;
+    cppcson::print(expected, root, {format, 0, false});
+
+    for (auto threads : {2u, 3u, 8u}) {
+      for (auto cache : {false, true}) {
+        std::ostringstream actual;
+        cppcson::print(actual, root, {format, threads, cache});
+        EXPECT_EQ(expected.str(), actual.str());
+      }
+    }
+  }
+}
+
+TEST(Writer, cache) {
+  std::istringstream stream("a: [1, {b: 'x', c: [2.5, {}]}, []]\n"
+                            "d: {e: {f: null}}\n"
+                            "g: 'some text'");
+  auto value = cppcson::parse(stream);
+
+  auto check = [&value]() {
+    for (auto format : {cppcson::WriterOptions::Format::Cson,
+                        cppcson::WriterOptions::Format::CompactCson,
+                        cppcson::WriterOptions::Format::Json}) {
+      std::ostringstream expected;
+      cppcson::print(expected, value, {format, 0, false});
+
+      for (auto i = 0; i < 2; ++i) {
+        std::ostringstream actual;
+        cppcson::print(actual, value, {format, 0, true});
+        EXPECT_EQ(expected.str(), actual.str());
+      }
+    }
+  };
+
+  check();
+
+  // Cached output is written without formatting anything again
+  cppcson::WriterOptions options = {cppcson::WriterOptions::Format::Cson, 0,
+                                    true};
+  auto size = cppcson::serializedSize(value, options);
+  auto allocations = allocationCount.load();
+  EXPECT_EQ(size, cppcson::serializedSize(value, options));
+  EXPECT_EQ(allocations, allocationCount.load());
+
+  value.add("h", cppcson::Value::newInt(3));
+  check();
+
+  value.remove("d");
+  check();
+
+  auto replacement = cppcson::Value::newArray();
+  replacement.add(cppcson::Value::newString("y"));
+  value = std::move(replacement);
+  check();
+
+  value.clear();
+  check();
+}
+
+TEST(Binary, roundTrip) {
+  std::istringstream stream("a: [1, -2.5, 'text', null, true, [], {}]\n"
+                            "b:\n"
+                            "  'c d': {e: 'text'}\n"
+                            "  f: 9223372036854775807");
+  auto value = cppcson::parse(stream);
+
+  std::string snapshot;
+  cppcson::saveBinary(snapshot, value);
+  auto loaded = cppcson::loadBinary(snapshot.data(), snapshot.size());
+
+  EXPECT_EQ(value, loaded);
+  auto &item = loaded.item("b").item("c d").item("e");
+  EXPECT_EQ(value.item("b").item("c d").item("e").getLocation(),
+            item.getLocation());
+  EXPECT_EQ(".b.\"c d\".e", item.getPath());
+  EXPECT_EQ(".a[2]", loaded.item("a").item(2).getPath());
+
+  std::ostringstream original;
+  std::ostringstream reloaded;
+  cppcson::print(original, value);
+  cppcson::print(reloaded, loaded);
+  EXPECT_EQ(original.str(), reloaded.str());
+
+  std::string small;
+  cppcson::saveBinary(small, value, {false, false});
+  EXPECT_LT(small.size(), snapshot.size());
+
+  auto stripped = cppcson::loadBinary(small.data(), small.size());
+  EXPECT_EQ(value, stripped);
+  EXPECT_EQ(cppcson::Location::unknown(),
+            stripped.item("b").item("f").getLocation());
+  EXPECT_EQ("", stripped.item("b").item("f").getPath());
+}
+
+TEST(Binary, stream) {
+  auto value = cppcson::Value::newArray();
+  for (auto i = 0; i < 10000; ++i) {
+    value.add(cppcson::Value::newString("item " + std::to_string(i % 100)));
+  }
+
+  std::stringstream stream;
+  cppcson::saveBinary(stream, value);
+  cppcson::saveBinary(stream, cppcson::Value::newInt(5));
+
+  EXPECT_EQ(value, cppcson::loadBinary(stream));
+  EXPECT_EQ(5, cppcson::loadBinary(stream).asInt());
+  EXPECT_THROW(cppcson::loadBinary(stream), cppcson::BinaryFormatError);
+}
+
+TEST(Binary, deep) {
+  auto value = cppcson::Value::newInt(1);
+  for (auto i = 0; i < 2000; ++i) {
+    auto array = cppcson::Value::newArray();
+    array.add(std::move(value));
+    value = std::move(array);
+  }
+
+  std::string snapshot;
+  cppcson::saveBinary(snapshot, value);
+  EXPECT_EQ(value, cppcson::loadBinary(snapshot.data(), snapshot.size()));
+}
+
+TEST(Binary, corrupt) {
+  std::istringstream stream("a: [1, 2]\nb: 'x'");
+  auto value = cppcson::parse(stream);
+
+  std::string snapshot;
+  cppcson::saveBinary(snapshot, value);
+
+  for (size_t i = 0; i < snapshot.size(); ++i) {
+    auto corrupt = snapshot;
+    corrupt[i] = static_cast<char>(corrupt[i] ^ 0x40);
+    EXPECT_THROW(cppcson::loadBinary(corrupt.data(), corrupt.size()),
+                 cppcson::BinaryFormatError);
+  }
+
+  EXPECT_THROW(cppcson::loadBinary(snapshot.data(), snapshot.size() - 1),
+               cppcson::BinaryFormatError);
+  EXPECT_THROW(cppcson::loadBinary(snapshot.data(), 10),
+               cppcson::BinaryFormatError);
+}
+
+TEST(Binary, view) {
+  std::istringstream stream("a: [1, -2.5, 'text', null, true]\n"
+                            "b:\n"
+                            "  'c d': {e: 'nested'}\n"
+                            "  f: {}\n"
+                            "z: 0");
+  auto value = cppcson::parse(stream);
+
+  std::string snapshot;
+  cppcson::saveBinary(snapshot, value);
+  cppcson::SnapshotView view(snapshot.data(), snapshot.size(), true);
+  auto root = view.root();
+
+  EXPECT_TRUE(root.isObject());
+  EXPECT_EQ(3, root.getItemCount());
+  EXPECT_EQ((std::vector<std::string>{"a", "b", "z"}), root.keys());
+  EXPECT_TRUE(root.contains("z"));
+  EXPECT_FALSE(root.contains("c"));
+
+  auto a = root.item("a");
+  EXPECT_EQ(1, a.item(0).asInt());
+  EXPECT_EQ(-2.5, a.item(1).asFloat());
+  EXPECT_EQ("text", a.item(2).asString());
+  EXPECT_TRUE(a.item(3).isNull());
+  EXPECT_TRUE(a.item(4).asBool());
+  EXPECT_EQ(value.item("a").item(2).getLocation(), a.item(2).getLocation());
+  EXPECT_EQ(".a[2]", a.item(2).getPath());
+
+  auto e = root.item("b").item("c d").item("e");
+  EXPECT_EQ("nested", e.asString());
+  EXPECT_EQ("e", e.getKey());
+  EXPECT_EQ(0, root.item("b").item("f").getItemCount());
+
+  int64_t sum = 0;
+  for (auto item : root) {
+    if (item.isInt()) {
+      sum += item.asInt();
+    }
+  }
+  EXPECT_EQ(0, sum);
+
+  EXPECT_THROW(a.item(5), cppcson::OutOfRangeError);
+  EXPECT_THROW(root.item("c"), cppcson::MissingKeyError);
+  EXPECT_THROW(a.asString(), cppcson::TypeError);
+  EXPECT_EQ(value.item("b"), root.item("b").toValue());
+}
+
+TEST(Binary, mapped) {
+  auto value = cppcson::Value::newObject();
+  for (auto i = 0; i < 1000; ++i) {
+    value.add("key" + std::to_string(i), cppcson::Value::newInt(i));
+  }
+
+  const char *FILE_NAME = "mapped_snapshot.bin";
+  {
+    std::ofstream file(FILE_NAME, std::ios::binary);
+    cppcson::saveBinary(file, value);
+  }
+
+  {
+    cppcson::MappedSnapshot snapshot(FILE_NAME, true);
+    auto root = snapshot.root();
+
+    for (auto i = 0; i < 1000; ++i) {
+      EXPECT_EQ(i, root.item("key" + std::to_string(i)).asInt());
+    }
+    EXPECT_EQ(value, root.toValue());
+  }
+
+  std::remove(FILE_NAME);
+  EXPECT_THROW(cppcson::MappedSnapshot snapshot(FILE_NAME), std::system_error);
+}
+
+static void visitView(const cppcson::ValueView &view) {
+  view.getPath();
+  view.getLocation();
+  view.getKey();
+
+  switch (view.getKind()) {
+  case cppcson::Value::Kind::String:
+    view.asString();
+    break;
+  case cppcson::Value::Kind::Array:
+  case cppcson::Value::Kind::Object:
+    for (auto item : view) {
+      visitView(item);
+    }
+    view.toValue();
+    break;
+  default:
+    break;
+  }
+}
+
+TEST(Binary, damagedView) {
+  std::istringstream stream("a: [1, 2, {x: 'y'}]\nb: 'x'");
+  auto value = cppcson::parse(stream);
+
+  std::string snapshot;
+  cppcson::saveBinary(snapshot, value);
+
+  // Without the checksum, damaged data is caught by the bounds checks
+  for (size_t i = 48; i < snapshot.size(); ++i) {
+    auto damaged = snapshot;
+    damaged[i] = static_cast<char>(damaged[i] ^ 0x40);
+
+    try {
+      cppcson::SnapshotView view(damaged.data(), damaged.size());
+      visitView(view.root());
+    } catch (const cppcson::Error &) {
+    }
+  }
+
+  // Adding 1 << 29 strings and removing 1 << 32 bytes of string data keeps
+  // the sum of the section sizes
+  auto wrapped = snapshot;
+  wrapped[23] = static_cast<char>(wrapped[23] + 0x20);
+  for (size_t i = 28; i < 32; ++i) {
+    wrapped[i] = static_cast<char>(0xff);
+  }
+  EXPECT_THROW(cppcson::SnapshotView(wrapped.data(), wrapped.size()),
+               cppcson::BinaryFormatError);
+}
+
+static void writeFile(const std::string &fileName, const std::string &text) {
+  std::ofstream file(fileName, std::ios::binary);
+  file << text;
+}
+
+TEST(ParseCache, unchangedFile) {
+  const char *FILE_NAME = "parse_cache_a.cson";
+  writeFile(FILE_NAME, "a: 1\nb: [1, 2]");
+
+  cppcson::ParseCache cache(4);
+  auto first = cache.load(FILE_NAME);
+  EXPECT_EQ(1, first->item("a").asInt());
+  EXPECT_EQ(first, cache.load(FILE_NAME));
+
+  // Rewriting the same contents keeps the document
+  writeFile(FILE_NAME, "a: 1\nb: [1, 2]");
+  EXPECT_EQ(first, cache.load(FILE_NAME));
+
+  // Changed contents of the same size are found by hash
+  writeFile(FILE_NAME, "a: 2\nb: [1, 2]");
+  auto second = cache.load(FILE_NAME);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(2, second->item("a").asInt());
+  EXPECT_EQ(1, cache.size());
+
+  std::remove(FILE_NAME);
+  EXPECT_THROW(cache.load(FILE_NAME), std::system_error);
+}
+
+TEST(ParseCache, leastRecentlyUsed) {
+  writeFile("parse_cache_a.cson", "1");
+  writeFile("parse_cache_b.cson", "2");
+  writeFile("parse_cache_c.cson", "3");
+
+  cppcson::ParseCache cache(2);
+  auto a = cache.load("parse_cache_a.cson");
+  auto b = cache.load("parse_cache_b.cson");
+  EXPECT_EQ(a, cache.load("parse_cache_a.cson"));
+
+  cache.load("parse_cache_c.cson");
+  EXPECT_EQ(2, cache.size());
+  EXPECT_EQ(a, cache.load("parse_cache_a.cson"));
+  EXPECT_NE(b, cache.load("parse_cache_b.cson"));
+
+  // Documents stay valid after being dropped
+  EXPECT_EQ(2, b->asInt());
+
+  std::remove("parse_cache_a.cson");
+  std::remove("parse_cache_b.cson");
+  std::remove("parse_cache_c.cson");
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+TEST(ParseCache, snapshots) {
+  const char *FILE_NAME = "parse_cache_d.cson";
+  writeFile(FILE_NAME, "a:\n  b: 'text'");
+
+  char directory[] = "parse_cache_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(directory));
+
+  {
+    cppcson::ParseCache cache(1, directory);
+    cache.load(FILE_NAME);
+  }
+
+  // A new cache loads the snapshot written by the first one
+  cppcson::ParseCache cache(1, directory);
+  auto document = cache.load(FILE_NAME);
+  EXPECT_EQ("text", document->item("a").item("b").asString());
+  EXPECT_EQ(cppcson::Location(2, 6, 2, 11),
+            document->item("a").item("b").getLocation());
+
+  std::vector<std::string> snapshots;
+  std::unique_ptr<DIR, int (*)(DIR *)> handle(opendir(directory), closedir);
+  while (auto entry = readdir(handle.get())) {
+    if (entry->d_name[0] != '.') {
+      snapshots.push_back(std::string(directory) + "/" + entry->d_name);
+    }
+  }
+  EXPECT_EQ(1u, snapshots.size());
+
+  for (auto &snapshot : snapshots) {
+    std::remove(snapshot.c_str());
+  }
+  rmdir(directory);
+  std::remove(FILE_NAME);
+}
+#endif
+
+TEST(ParseCache, threads) {
+  const char *FILE_NAME = "parse_cache_e.cson";
+  writeFile(FILE_NAME, "[1, 2, 3]");
+
+  cppcson::ParseCache cache(1);
+  std::vector<std::shared_ptr<const cppcson::Value>> documents(8);
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < documents.size(); ++i) {
+    threads.emplace_back([&cache, &documents, i, FILE_NAME]() {
+      for (auto j = 0; j < 100; ++j) {
+        documents[i] = cache.load(FILE_NAME);
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (auto &document : documents) {
+    EXPECT_EQ(*documents[0], *document);
+  }
+
+  std::remove(FILE_NAME);
+}
+
+TEST(Value, hash) {
+  std::istringstream stream("a: [1, 2.5, 'x']\nb:\n  c: null\n  d: true");
+  auto value = cppcson::parse(stream);
+
+  auto built = cppcson::Value::newObject();
+  auto items = cppcson::Value::newArray();
+  items.add(cppcson::Value::newInt(1));
+  items.add(cppcson::Value::newFloat(2.5));
+  items.add(cppcson::Value::newString("x"));
+  built.add("a", std::move(items));
+  auto inner = cppcson::Value::newObject();
+  inner.add("c", cppcson::Value::newNull());
+  inner.add("d", cppcson::Value::newBool(true));
+  built.add("b", std::move(inner));
+
+  // Locations and paths do not matter
+  EXPECT_EQ(value.hash(), built.hash());
+  EXPECT_EQ(value, built);
+
+  // Modifications drop the cached hash
+  auto hash = built.hash();
+  built.add("e", cppcson::Value::newInt(0));
+  EXPECT_NE(hash, built.hash());
+  EXPECT_NE(value, built);
+  built.remove("e");
+  EXPECT_EQ(hash, built.hash());
+
+  EXPECT_EQ(cppcson::Value::newFloat(0.0).hash(),
+            cppcson::Value::newFloat(-0.0).hash());
+  EXPECT_NE(cppcson::Value::newInt(1).hash(),
+            cppcson::Value::newFloat(1).hash());
+  EXPECT_NE(cppcson::Value::newArray().hash(),
+            cppcson::Value::newObject().hash());
+}
+
+TEST(Value, order) {
+  std::vector<cppcson::Value> values;
+  values.push_back(cppcson::Value::newString("b"));
+  values.push_back(cppcson::Value::newFloat(std::nan("")));
+  values.push_back(cppcson::Value::newInt(2));
+  values.push_back(cppcson::Value::newFloat(-1));
+  values.push_back(cppcson::Value::newString("a"));
+  values.push_back(cppcson::Value::newBool(false));
+  values.push_back(cppcson::Value::newInt(-3));
+
+  std::sort(values.begin(), values.end());
+  std::ostringstream stream;
+  for (auto &value : values) {
+    stream << value << " ";
+  }
+  EXPECT_EQ("false -3 2 -1.0 nan \"a\" \"b\" ", stream.str());
+
+  std::istringstream a("[1, 2]"), b("[1, 2, 0]"), c("[1, 3]");
+  auto first = cppcson::parse(a);
+  auto second = cppcson::parse(b);
+  auto third = cppcson::parse(c);
+  EXPECT_TRUE(first < second);
+  EXPECT_TRUE(second < third);
+  EXPECT_FALSE(third < first);
+  EXPECT_FALSE(first < first);
+
+  std::istringstream d("a: 1"), e("a: 2"), f("b: 0");
+  auto fourth = cppcson::parse(d);
+  auto fifth = cppcson::parse(e);
+  auto sixth = cppcson::parse(f);
+  EXPECT_TRUE(fourth < fifth);
+  EXPECT_TRUE(fifth < sixth);
+}
+
+TEST(Value, deduplicate) {
+  std::unordered_set<cppcson::Value> unique;
+
+  for (auto text : {"a: 1", "[2]", "a: 1", "[2]", "a: 2"}) {
+    std::istringstream stream(text);
+    unique.insert(cppcson::parse(stream));
+  }
+  EXPECT_EQ(3, unique.size());
+}
+
+TEST(Value, clone) {
+  std::istringstream stream("a: [1, [2, 3]]\nb:\n  c: 'text'");
+  auto original = cppcson::parse(stream);
+
+  auto before = allocationCount.load();
+  auto copy = original.clone();
+  auto after = allocationCount.load();
+
+  // Items are shared instead of copied
+  EXPECT_EQ(0, after - before);
+  EXPECT_EQ(original, copy);
+  EXPECT_EQ(&original.item("a"), &copy.item("a"));
+
+  // Modifying copies only the items of the modified container
+  copy.add("d", cppcson::Value::newNull());
+  EXPECT_FALSE(original.contains("d"));
+  EXPECT_TRUE(copy.contains("d"));
+  EXPECT_NE(&original.item("a"), &copy.item("a"));
+  EXPECT_EQ(&original.item("a").item(1), &copy.item("a").item(1));
+  EXPECT_EQ(original.item("b").item("c").getLocation(),
+            copy.item("b").item("c").getLocation());
+
+  auto items = copy.item("a").clone();
+  items.remove(0u);
+  copy.remove("a");
+  copy.add("a", std::move(items));
+  EXPECT_EQ(2, original.item("a").getItemCount());
+  EXPECT_EQ(1, copy.item("a").getItemCount());
+
+  auto cleared = original.clone();
+  cleared.clear();
+  EXPECT_EQ(0, cleared.getItemCount());
+  EXPECT_EQ(2, original.getItemCount());
+  EXPECT_EQ("text", original.item("b").item("c").asString());
+}
+
+TEST(Value, cloneThreads) {
+  std::istringstream stream("[{a: 1}, {b: [2, 3]}]");
+  auto original = cppcson::parse(stream);
+  std::vector<std::thread> threads;
+
+  for (auto i = 0; i < 8; ++i) {
+    threads.emplace_back([&original, i]() {
+      for (auto j = 0; j < 100; ++j) {
+        auto copy = original.clone();
+        copy.add(cppcson::Value::newInt(i));
+        auto item = copy.item(1).clone();
+        EXPECT_EQ(original.item(1), item);
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(2, original.getItemCount());
+}
+
+TEST(Path, at) {
+  std::istringstream stream("a:\n  b: [1, {c: true}]\n'x y': {z: 'v'}");
+  auto value = cppcson::parse(stream);
+
+  EXPECT_TRUE(value.at(cppcson::Path(".a.b[1].c")).asBool());
+  EXPECT_EQ("v", value.at(cppcson::Path(".\"x y\".z")).asString());
+  EXPECT_EQ(&value, &value.at(cppcson::Path(".")));
+
+  // Paths written by getPath() lead back to their value
+  auto &item = value.item("a").item("b").item(1).item("c");
+  EXPECT_EQ(&item, &value.at(cppcson::Path(item.getPath())));
+
+  EXPECT_THROW(value.at(cppcson::Path(".a.d")), cppcson::MissingKeyError);
+  EXPECT_THROW(value.at(cppcson::Path(".a.b[2]")), cppcson::OutOfRangeError);
+  EXPECT_THROW(value.at(cppcson::Path(".a[0]")), cppcson::TypeError);
+  EXPECT_THROW(cppcson::Path("a"), cppcson::PathError);
+  EXPECT_THROW(cppcson::Path(".a[x]"), cppcson::PathError);
+  EXPECT_THROW(cppcson::Path(".\"a"), cppcson::PathError);
+}
+
+TEST(Path, cache) {
+  std::istringstream stream("a: {b: [1, 2]}\nc: 3");
+  auto value = cppcson::parse(stream);
+  cppcson::Path path(".a.b[1]", true);
+
+  auto &item = value.at(path);
+  EXPECT_EQ(2, item.asInt());
+  EXPECT_EQ(&item, &value.at(path));
+
+  // Unmodified clones share the items holding the cached value
+  auto copy = value.clone();
+  EXPECT_EQ(&item, &copy.at(path));
+
+  // Modifications copy the cached items, so the cache no longer matches
+  copy.remove("c");
+  EXPECT_EQ(2, copy.at(path).asInt());
+  value.add("d", cppcson::Value::newNull());
+  EXPECT_EQ(2, value.at(path).asInt());
+
+  std::istringstream otherStream("a: {b: [3, 4]}");
+  auto other = cppcson::parse(otherStream);
+  EXPECT_EQ(4, other.at(path).asInt());
+  EXPECT_EQ(2, value.at(path).asInt());
+
+  cppcson::Path copiedPath(path);
+  EXPECT_EQ(".a.b[1]", copiedPath.toString());
+  EXPECT_EQ(4, other.at(copiedPath).asInt());
+}
+
+TEST(Path, cacheThreads) {
+  std::istringstream first("a: [{b: 1}]");
+  std::istringstream second("a: [{b: 2}]");
+  cppcson::Value documents[] = {cppcson::parse(first),
+                                cppcson::parse(second)};
+  cppcson::Path path(".a[0].b", true);
+  std::vector<std::thread> threads;
+
+  for (auto i = 0; i < 8; ++i) {
+    threads.emplace_back([&documents, &path, i]() {
+      for (auto j = 0; j < 1000; ++j) {
+        auto index = (i + j / 100) % 2;
+        EXPECT_EQ(index + 1, documents[index].at(path).asInt());
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+TEST(Key, literal) {
+  using namespace cppcson::literals;
+
+  static_assert("port"_key.length() == 4, "length is constexpr");
+  static constexpr cppcson::Key HOST("host");
+  static_assert(HOST.length() == "host"_key.length(), "constructors agree");
+
+  std::istringstream stream("host: 'a'\nports: [80, 443]\n'x y': {z: 1}");
+  auto value = cppcson::parse(stream);
+
+  EXPECT_EQ("a", value[HOST].asString());
+  EXPECT_EQ(443, value["ports"_key][1].asInt());
+  EXPECT_EQ(1, value.item("x y"_key).item("z"_key).asInt());
+  EXPECT_TRUE(value.contains("ports"_key));
+  EXPECT_FALSE(value.contains("port"_key));
+  EXPECT_THROW(value["port"_key], cppcson::MissingKeyError);
+
+  std::string snapshot;
+  cppcson::saveBinary(snapshot, value);
+  cppcson::SnapshotView view(snapshot.data(), snapshot.size());
+  auto root = view.root();
+  EXPECT_EQ("a", root[HOST].asString());
+  EXPECT_EQ(80, root["ports"_key][0].asInt());
+  EXPECT_TRUE(root.contains("x y"_key));
+  EXPECT_FALSE(root.contains("x"_key));
+  EXPECT_THROW(root["port"_key], cppcson::MissingKeyError);
+
+  // Keys longer than the small string buffer are looked up without allocating
+  std::istringstream longStream("a_key_longer_than_small_strings: 1");
+  auto longValue = cppcson::parse(longStream);
+  longValue["a_key_longer_than_small_strings"_key];
+  std::string longSnapshot;
+  cppcson::saveBinary(longSnapshot, longValue);
+  cppcson::SnapshotView longView(longSnapshot.data(), longSnapshot.size());
+
+  auto before = allocationCount.load();
+  EXPECT_EQ(1, longValue["a_key_longer_than_small_strings"_key].asInt());
+  EXPECT_EQ(1, longView.root()["a_key_longer_than_small_strings"_key].asInt());
+  EXPECT_EQ(before, allocationCount.load());
+
+  EXPECT_EQ(HOST, "host"_key);
+  EXPECT_NE("port"_key, "ports"_key);
+  EXPECT_NE("host"_key, "hose"_key);
+}
+
+static std::string describe(const std::vector<cppcson::PatchOperation> &patch) {
+  static const char *KINDS[] = {"add", "remove", "replace"};
+
+  std::ostringstream stream;
+  for (auto &operation : patch) {
+    stream << KINDS[static_cast<int>(operation.kind)] << " " << operation.path;
+    if (operation.kind != cppcson::PatchOperation::Kind::Remove) {
+      stream << " " << operation.value;
+    }
+    stream << "\n";
+  }
+
+  return stream.str();
+}
+
+TEST(Patch, diff) {
+  std::istringstream fromStream("a: 1\n"
+                                "b: [1, 2, 3]\n"
+                                "c:\n"
+                                "  d: 'x'\n"
+                                "  e: true\n"
+                                "'f.g': null\n"
+                                "h: [{i: 1}]");
+  std::istringstream toStream("a: 1.0\n"
+                              "b: [1, 5]\n"
+                              "c:\n"
+                              "  d: 'x'\n"
+                              "  k: false\n"
+                              "'f.g': [1]\n"
+                              "h: [{i: 1}, 2, 3]\n"
+                              "j: {}");
+  auto from = cppcson::parse(fromStream);
+  auto to = cppcson::parse(toStream);
+
+  auto patch = cppcson::diff(from, to);
+  EXPECT_EQ("replace .a 1.0\n"
+            "replace .b[1] 5\n"
+            "remove .b[2]\n"
+            "remove .c.e\n"
+            "add .c.k false\n"
+            "replace .\"f.g\" [1]\n"
+            "add .h[1] 2\n"
+            "add .h[2] 3\n"
+            "add .j {}\n",
+            describe(patch));
+
+  // Paths match the ones of the parsed values
+  EXPECT_EQ(to.item("c").item("k").getPath(), patch[4].path);
+  EXPECT_EQ(to.item("f.g").getPath(), patch[5].path);
+
+  cppcson::apply(from, patch);
+  EXPECT_EQ(to, from);
+  EXPECT_TRUE(cppcson::diff(from, to).empty());
+}
+
+TEST(Patch, sharedBranches) {
+  auto items = cppcson::Value::newArray();
+  for (auto i = 0; i < 1000; ++i) {
+    auto entry = cppcson::Value::newObject();
+    entry.add("id", cppcson::Value::newInt(i));
+    items.add(std::move(entry));
+  }
+  auto from = cppcson::Value::newObject();
+  from.add("items", std::move(items));
+  from.add("version", cppcson::Value::newInt(1));
+
+  // Clones share the unchanged branches, which are skipped unhashed
+  auto to = from.clone();
+  to.remove("version");
+  to.add("version", cppcson::Value::newInt(2));
+
+  auto patch = cppcson::diff(from, to);
+  EXPECT_EQ("replace .version 2\n", describe(patch));
+
+  auto updated = from.clone();
+  cppcson::apply(updated, patch);
+  EXPECT_EQ(to, updated);
+  EXPECT_EQ(1, from.item("version").asInt());
+}
+
+TEST(Patch, hashCollision) {
+  // Flipping bit 63 of two words gave equal hashes with word-wise FNV
+  std::string name = "0123456a89abcdeb";
+  auto changedName = name;
+  changedName[7] = static_cast<char>(0xE1);
+  changedName[15] = static_cast<char>(0xE2);
+
+  auto from = cppcson::Value::newObject();
+  from.add("name", cppcson::Value::newString(name));
+  from.add("port", cppcson::Value::newInt(1));
+  auto to = cppcson::Value::newObject();
+  to.add("name", cppcson::Value::newString(changedName));
+  to.add("port", cppcson::Value::newInt(1));
+
+  EXPECT_NE(from, to);
+  EXPECT_NE(from.hash(), to.hash());
+  EXPECT_EQ(1u, cppcson::diff(from, to).size());
+}
+
+TEST(Patch, emptyKeys) {
+  std::istringstream fromStream("'': 1\nb: {'': 2}");
+  auto from = cppcson::parse(fromStream);
+  std::istringstream toStream("'': 2\nb: {'': 3}");
+  auto to = cppcson::parse(toStream);
+
+  auto patch = cppcson::diff(from, to);
+  ASSERT_EQ(2u, patch.size());
+  EXPECT_EQ(".\"\"", patch[0].path);
+  EXPECT_EQ(".b.\"\"", patch[1].path);
+
+  cppcson::apply(from, patch);
+  EXPECT_EQ(to, from);
+}
+
+TEST(Patch, apply) {
+  std::istringstream stream("a:\n  b: [1, 2]\n'x y': 0");
+  auto value = cppcson::parse(stream);
+
+  std::vector<cppcson::PatchOperation> patch;
+  patch.push_back({cppcson::PatchOperation::Kind::Add, ".a.b[0]",
+                   cppcson::Value::newInt(0)});
+  patch.push_back({cppcson::PatchOperation::Kind::Replace, ".\"x y\"",
+                   cppcson::Value::newString("z")});
+  patch.push_back({cppcson::PatchOperation::Kind::Remove, ".a.b[2]",
+                   cppcson::Value::newNull()});
+  cppcson::apply(value, patch);
+
+  std::ostringstream text;
+  text << value;
+  EXPECT_EQ("{a: {b: [0, 1]}, \"x y\": \"z\"}", text.str());
+
+  auto failing = [&value](cppcson::PatchOperation::Kind kind,
+                          const std::string &path) {
+    std::vector<cppcson::PatchOperation> patch;
+    patch.push_back({kind, path, cppcson::Value::newNull()});
+    cppcson::apply(value, patch);
+  };
+  EXPECT_THROW(failing(cppcson::PatchOperation::Kind::Add, ".a"),
+               cppcson::PatchError);
+  EXPECT_THROW(failing(cppcson::PatchOperation::Kind::Add, ".a.b[3]"),
+               cppcson::OutOfRangeError);
+  EXPECT_THROW(failing(cppcson::PatchOperation::Kind::Remove, ".c"),
+               cppcson::MissingKeyError);
+  EXPECT_THROW(failing(cppcson::PatchOperation::Kind::Replace, ".a[0]"),
+               cppcson::TypeError);
+  EXPECT_THROW(failing(cppcson::PatchOperation::Kind::Remove, "."),
+               cppcson::PatchError);
+  EXPECT_THROW(failing(cppcson::PatchOperation::Kind::Replace, ".a.b[x]"),
+               cppcson::PatchError);
+  EXPECT_THROW(failing(cppcson::PatchOperation::Kind::Replace, "a"),
+               cppcson::PatchError);
+
+  failing(cppcson::PatchOperation::Kind::Replace, ".");
+  EXPECT_TRUE(value.isNull());
+}
+
+TEST(SharedDocument, publish) {
+  cppcson::SharedDocument document(cppcson::Value::newInt(1));
+
+  auto first = document.pin();
+  EXPECT_EQ(1, first->asInt());
+
+  // Publishing does not wait for readers, which keep their snapshot
+  document.publish(cppcson::Value::newInt(2));
+  auto second = document.pin();
+  EXPECT_EQ(1, first->asInt());
+  EXPECT_EQ(2, second->asInt());
+
+  first = std::move(second);
+  EXPECT_EQ(2, (*first).asInt());
+  document.synchronize();
+  EXPECT_EQ(2, first.get()->asInt());
+}
+
+TEST(SharedDocument, threads) {
+  auto version = [](int64_t number) {
+    auto value = cppcson::Value::newObject();
+    value.add("number", cppcson::Value::newInt(number));
+    value.add("copy", cppcson::Value::newString(std::to_string(number)));
+    return value;
+  };
+
+  cppcson::SharedDocument document(version(0));
+  std::atomic<bool> done(false);
+  std::vector<std::thread> readers;
+
+  for (auto i = 0; i < 4; ++i) {
+    readers.emplace_back([&document, &done]() {
+      int64_t last = 0;
+      while (!done) {
+        auto snapshot = document.pin();
+        auto number = snapshot->item("number").asInt();
+        EXPECT_EQ(std::to_string(number), snapshot->item("copy").asString());
+        EXPECT_LE(last, number);
+        last = number;
+      }
+    });
+  }
+
+  for (auto i = 1; i <= 500; ++i) {
+    document.publish(version(i));
+  }
+  done = true;
+
+  for (auto &reader : readers) {
+    reader.join();
+  }
+
+  document.synchronize();
+  EXPECT_EQ(500, document.pin()->item("number").asInt());
+}
+
+struct Endpoint {
+  std::string host;
+  uint16_t port = 80;
+};
+
+struct Service {
+  std::string name;
+  bool enabled = true;
+  std::vector<Endpoint> endpoints;
+  std::map<std::string, double> weights;
+};
+
+namespace cppcson {
+template <> struct Fields<Endpoint> {
+  static void describe(FieldList<Endpoint> &fields) {
+    fields.add(CPPCSON_FIELD(Endpoint, host))
+        .optional(CPPCSON_FIELD(Endpoint, port));
+  }
+};
+
+template <> struct Fields<Service> {
+  static void describe(FieldList<Service> &fields) {
+    fields.add(CPPCSON_FIELD(Service, name))
+        .optional(CPPCSON_FIELD(Service, enabled))
+        .add(CPPCSON_FIELD(Service, endpoints))
+        .optional(CPPCSON_FIELD(Service, weights));
+  }
+};
+} // namespace cppcson
+
+TEST(Binding, decode) {
+  std::istringstream stream("name: 'api'\n"
+                            "comment: {skipped: [1, {a: 2}], b: null}\n"
+                            "endpoints: [\n"
+                            "  {host: 'a', port: 8080}\n"
+                            "  {host: 'b', extra: [[]]}\n"
+                            "]\n"
+                            "weights:\n"
+                            "  a: 0.5\n"
+                            "  b: 2");
+  Service service;
+  cppcson::decode(stream, service);
+
+  EXPECT_EQ("api", service.name);
+  EXPECT_TRUE(service.enabled);
+  ASSERT_EQ(2u, service.endpoints.size());
+  EXPECT_EQ("a", service.endpoints[0].host);
+  EXPECT_EQ(8080, service.endpoints[0].port);
+  EXPECT_EQ("b", service.endpoints[1].host);
+  EXPECT_EQ(80, service.endpoints[1].port);
+  EXPECT_EQ((std::map<std::string, double>{{"a", 0.5}, {"b", 2.0}}),
+            service.weights);
+}
+
+TEST(Binding, errors) {
+  auto decode = [](const std::string &text) {
+    std::istringstream stream(text);
+    Service service;
+    cppcson::decode(stream, service);
+  };
+
+  try {
+    decode("name: 'api'\nendpoints: [{port: 1}]");
+    FAIL();
+  } catch (const cppcson::MissingKeyError &e) {
+    EXPECT_STREQ("Key host does not exist under .endpoints[0]", e.what());
+    EXPECT_EQ(cppcson::Location(2, 13, 2, 21), e.getLocation());
+  }
+
+  try {
+    decode("name: 'api'\nendpoints: [{host: 'a', port: 'x'}]");
+    FAIL();
+  } catch (const cppcson::TypeError &e) {
+    EXPECT_STREQ("Expected integer value but found string in "
+                 ".endpoints[0].port",
+                 e.what());
+    EXPECT_EQ(cppcson::Location(2, 31, 2, 33), e.getLocation());
+  }
+
+  EXPECT_THROW(decode("name: 'api'\nendpoints: [{host: 'a', port: 65536}]"),
+               cppcson::LimitExceededError);
+  EXPECT_THROW(decode("name: 'api'"), cppcson::MissingKeyError);
+  EXPECT_THROW(decode("[]"), cppcson::TypeError);
+  EXPECT_THROW(decode("name: 'api'\nendpoints: [\n"), cppcson::SyntaxError);
+}
+
+TEST(Binding, encode) {
+  Service service;
+  service.name = "api";
+  service.endpoints.push_back({"a", 8080});
+  service.endpoints.push_back({"b\n", 80});
+  service.weights["x y"] = 1.5;
+
+  auto text = cppcson::encode(service);
+  std::istringstream stream(text);
+  auto value = cppcson::parse(stream);
+  std::ostringstream printStream;
+  cppcson::print(printStream, value);
+  EXPECT_EQ(printStream.str(), text);
+
+  std::vector<bool> flags{true, false, true};
+  std::istringstream flagStream(cppcson::encode(flags));
+  std::vector<bool> flagsDecoded;
+  cppcson::decode(flagStream, flagsDecoded);
+  EXPECT_EQ(flags, flagsDecoded);
+
+  std::vector<uint64_t> big{UINT64_MAX};
+  EXPECT_THROW(cppcson::encode(big), cppcson::LimitExceededError);
+  big[0] = INT64_MAX;
+  std::istringstream bigStream(cppcson::encode(big));
+  std::vector<uint64_t> bigDecoded;
+  cppcson::decode(bigStream, bigDecoded);
+  EXPECT_EQ(big, bigDecoded);
+
+  std::istringstream decodeStream(text);
+  Service decoded;
+  cppcson::decode(decodeStream, decoded);
+  EXPECT_EQ("api", decoded.name);
+  ASSERT_EQ(2u, decoded.endpoints.size());
+  EXPECT_EQ("b\n", decoded.endpoints[1].host);
+  EXPECT_EQ(80, decoded.endpoints[1].port);
+  EXPECT_EQ(service.weights, decoded.weights);
+}
+
+static std::vector<std::string>
+describe(const std::vector<cppcson::Violation> &violations) {
+  std::vector<std::string> descriptions;
+  for (auto &violation : violations) {
+    descriptions.push_back(
+        violation.path + ": " + violation.message + " at " +
+        std::to_string(violation.location.getStartLine()) + ":" +
+        std::to_string(violation.location.getStartColumn()));
+  }
+  return descriptions;
+}
+
+static cppcson::Schema serviceSchema() {
+  std::istringstream stream("type: 'object'\n"
+                            "required: ['name', 'endpoints']\n"
+                            "additionalProperties: false\n"
+                            "properties:\n"
+                            "  name: {type: 'string'}\n"
+                            "  mode: {enum: ['fast', 'safe']}\n"
+                            "  tags: {type: 'array', maxItems: 2}\n"
+                            "  endpoints:\n"
+                            "    type: 'array'\n"
+                            "    minItems: 1\n"
+                            "    items:\n"
+                            "      type: 'object'\n"
+                            "      required: ['port']\n"
+                            "      properties:\n"
+                            "        port: {type: 'integer', minimum: 1, "
+                            "maximum: 65535}\n"
+                            "        weight: {type: 'number', minimum: 0}");
+  return cppcson::Schema(cppcson::parse(stream));
+}
+
+TEST(Schema, validate) {
+  auto schema = serviceSchema();
+  std::string text = "name: 'api'\n"
+                     "endpoints: [{port: 80, weight: 1.5}, {port: 8080}]";
+  std::istringstream stream(text);
+  EXPECT_TRUE(schema.validate(cppcson::parse(stream)).empty());
+  std::istringstream eventStream(text);
+  EXPECT_TRUE(schema.validate(eventStream).empty());
+
+  text = "mode: 'slow'\n"
+         "tags: [1, 2, 3]\n"
+         "extra: {a: 1}\n"
+         "endpoints: [{port: 0}, {weight: -1, port: 'x'}, {}, 5]";
+  std::istringstream invalidStream(text);
+  auto violations = describe(schema.validate(cppcson::parse(invalidStream)));
+
+  std::vector<std::string> expected = {
+      ".endpoints[0].port: Value is less than the minimum 1 at 4:20",
+      ".endpoints[1].port: Expected integer value but found string at 4:43",
+      ".endpoints[1].weight: Value is less than the minimum 0 at 4:33",
+      ".endpoints[2]: Key port does not exist at 4:49",
+      ".endpoints[3]: Expected object value but found integer at 4:53",
+      ".extra: Key extra is not allowed at 3:8",
+      ".mode: Value is not one of the allowed values at 1:7",
+      ".tags: Expected at most 2 items at 2:7",
+      ".: Key name does not exist at 1:1"};
+  EXPECT_EQ(expected, violations);
+
+  // Validating while parsing reports in document order instead of key order
+  std::istringstream invalidEventStream(text);
+  auto eventViolations = describe(schema.validate(invalidEventStream));
+  std::sort(violations.begin(), violations.end());
+  std::sort(eventViolations.begin(), eventViolations.end());
+  EXPECT_EQ(violations, eventViolations);
+}
+
+TEST(Schema, invalid) {
+  auto compile = [](const std::string &text) {
+    std::istringstream stream(text);
+    cppcson::Schema schema(cppcson::parse(stream));
+  };
+
+  EXPECT_THROW(compile("type: 'integr'"), cppcson::SchemaError);
+  EXPECT_THROW(compile("enum: [[1]]"), cppcson::SchemaError);
+  EXPECT_THROW(compile("minItems: -1"), cppcson::SchemaError);
+  EXPECT_THROW(compile("minimum: 'a'"), cppcson::TypeError);
+  EXPECT_THROW(compile("items: 1"), cppcson::TypeError);
+  EXPECT_NO_THROW(compile("description: 'ignored'"));
+}
+
+#ifdef CPPCSON_WITH_INOTIFY
+class ChangeCollector {
+private:
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<cppcson::FileChange> changes;
+
+public:
+  void add(const cppcson::FileChange &change) {
+    std::lock_guard<std::mutex> lock(mutex);
+    changes.push_back({change.fileName, change.document, change.previous, {},
+                       change.error});
+    for (auto &operation : change.patch) {
+      changes.back().patch.push_back(
+          {operation.kind, operation.path, operation.value.clone()});
+    }
+    changed.notify_all();
+  }
+
+  // Waits until count changes arrived, returning all of them
+  std::vector<cppcson::FileChange> wait(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait_for(lock, std::chrono::seconds(5),
+                     [this, count]() { return changes.size() >= count; });
+    return std::move(changes);
+  }
+};
+
+TEST(FileWatcher, file) {
+  const char *FILE_NAME = "watched_a.cson";
+  writeFile(FILE_NAME, "a: 1\nb: 'x'");
+
+  ChangeCollector collector;
+  cppcson::FileWatcher watcher(
+      [&collector](const cppcson::FileChange &change) {
+        collector.add(change);
+      },
+      50);
+  watcher.watch(FILE_NAME);
+  EXPECT_EQ(1, watcher.document(FILE_NAME)->item("a").asInt());
+
+  writeFile(FILE_NAME, "a: 2\nb: 'x'");
+  auto changes = collector.wait(1);
+  ASSERT_EQ(1, changes.size());
+  EXPECT_EQ(FILE_NAME, changes[0].fileName);
+  EXPECT_EQ(1, changes[0].previous->item("a").asInt());
+  EXPECT_EQ(2, changes[0].document->item("a").asInt());
+  ASSERT_EQ(1, changes[0].patch.size());
+  EXPECT_EQ(".a", changes[0].patch[0].path);
+  EXPECT_EQ(changes[0].document, watcher.document(FILE_NAME));
+
+  // Replacing the file by renaming is noticed as well
+  writeFile("watched_a.tmp", "a: 3\nb: 'x'");
+  std::rename("watched_a.tmp", FILE_NAME);
+  changes = collector.wait(1);
+  ASSERT_EQ(1, changes.size());
+  EXPECT_EQ(3, changes[0].document->item("a").asInt());
+
+  writeFile(FILE_NAME, "a: [");
+  changes = collector.wait(1);
+  ASSERT_EQ(1, changes.size());
+  EXPECT_TRUE(changes[0].error != nullptr);
+  EXPECT_EQ(3, watcher.document(FILE_NAME)->item("a").asInt());
+
+  std::remove(FILE_NAME);
+  changes = collector.wait(1);
+  ASSERT_EQ(1, changes.size());
+  EXPECT_EQ(nullptr, changes[0].document);
+  EXPECT_EQ(nullptr, watcher.document(FILE_NAME));
+}
+
+TEST(FileWatcher, directory) {
+  const std::string DIRECTORY = "watched_directory";
+  mkdir(DIRECTORY.c_str(), 0755);
+  writeFile(DIRECTORY + "/a.cson", "1");
+  writeFile(DIRECTORY + "/b.txt", "2");
+
+  ChangeCollector collector;
+  cppcson::FileWatcher watcher(
+      [&collector](const cppcson::FileChange &change) {
+        collector.add(change);
+      },
+      50);
+  watcher.watch(DIRECTORY + "/");
+  EXPECT_EQ(1, watcher.document(DIRECTORY + "/a.cson")->asInt());
+  EXPECT_EQ(nullptr, watcher.document(DIRECTORY + "/b.txt"));
+
+  // Other files are ignored and bursts of writes are reported once
+  writeFile(DIRECTORY + "/b.txt", "3");
+  for (auto i = 0; i < 10; ++i) {
+    writeFile(DIRECTORY + "/c.cson", std::to_string(i));
+  }
+  auto changes = collector.wait(1);
+  ASSERT_EQ(1, changes.size());
+  EXPECT_EQ(DIRECTORY + "/c.cson", changes[0].fileName);
+  EXPECT_EQ(nullptr, changes[0].previous);
+  EXPECT_EQ(9, changes[0].document->asInt());
+
+  // Unchanged contents are not reported
+  writeFile(DIRECTORY + "/a.cson", "1");
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  writeFile(DIRECTORY + "/a.cson", "4");
+  changes = collector.wait(1);
+  ASSERT_EQ(1, changes.size());
+  EXPECT_EQ(4, changes[0].document->asInt());
+
+  std::remove((DIRECTORY + "/a.cson").c_str());
+  std::remove((DIRECTORY + "/b.txt").c_str());
+  std::remove((DIRECTORY + "/c.cson").c_str());
+  collector.wait(2);
+  rmdir(DIRECTORY.c_str());
+}
+#endif